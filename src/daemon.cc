@@ -0,0 +1,327 @@
+#include "daemon.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <pugixml.hpp>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "failure.hh"
+#include "pool.hh"
+#include "simulation.hh"
+#include "unit.hh"
+#include "util.hh"
+
+namespace oldspot
+{
+
+using namespace pugi;
+using namespace std;
+
+/**
+ * Load the systems described by the given chip configurations and compute their
+ * reliability functions so they are ready to simulate.  Each is identified by the
+ * path it was loaded from.
+ */
+Daemon::Daemon(const vector<string>& configs, const set<shared_ptr<FailureMechanism>>& m,
+               size_t max_configs, bool lump, int n, const string& time_units, bool verbose)
+    : mechanisms(m), max_configurations(max_configs), lumping(lump), iterations(n), units(time_units)
+{
+    for (const string& config: configs)
+    {
+        if (models.count(config) > 0)
+            continue;
+        unique_ptr<Model> model(new Model);
+        xml_parse_result result = model->doc.load_file(config.c_str());
+        if (!result)
+        {
+            cerr << config << ": " << result.description() << " at offset " << result.offset << endl;
+            exit(1);
+        }
+        if (verbose)
+            cout << "Loading " << config << "..." << endl;
+        unique_ptr<Simulation> simulation(new Simulation(model->doc, max_configurations, verbose));
+        simulation->prepare(mechanisms, model->cache, lumping);
+        model->idle.push_back(move(simulation));
+        models[config] = move(model);
+    }
+}
+
+/**
+ * Create a new copy of a model's system with the given quantities of units replaced
+ * by constants.  Reliability functions of traces that aren't affected are taken from
+ * the ones computed when the model was loaded.
+ */
+unique_ptr<Simulation>
+Daemon::build(Model& model, const map<pair<string, string>, double>& overrides)
+{
+    unique_ptr<Simulation> simulation(new Simulation(model.doc, max_configurations));
+    for (const auto& o: overrides)
+    {
+        shared_ptr<Unit> unit = simulation->unit(o.first.first);
+        if (!unit)
+            throw invalid_argument("unknown unit \"" + o.first.first + '"');
+        unit->override(o.first.second, o.second);
+    }
+    ReliabilityCache cache = model.cache; // Overridden traces only live as long as this request
+    simulation->prepare(mechanisms, cache, lumping);
+    return simulation;
+}
+
+/**
+ * Perform the simulation described by a request and return the response.
+ */
+string
+Daemon::handle(const string& request)
+{
+    string id;
+    int n = iterations;
+    unsigned long seed = random_device()();
+    map<pair<string, string>, double> overrides;
+
+    istringstream tokens(request);
+    string token;
+    while (tokens >> token)
+    {
+        size_t equals = token.find('=');
+        if (equals == string::npos)
+            return "error: expected key=value but got \"" + token + '"';
+        string key = token.substr(0, equals), value = token.substr(equals + 1);
+        try
+        {
+            if (key == "model")
+                id = value;
+            else if (key == "iterations")
+                n = stoi(value);
+            else if (key == "seed")
+                seed = stoul(value);
+            else
+            {
+                size_t dot = key.rfind('.');
+                if (dot == string::npos || dot == 0 || dot == key.size() - 1)
+                    return "error: unknown key \"" + key + '"';
+                overrides[{key.substr(0, dot), key.substr(dot + 1)}] = stod(value);
+            }
+        }
+        catch (const logic_error&)
+        {
+            return "error: invalid value \"" + value + "\" for " + key;
+        }
+    }
+    auto model = models.find(id);
+    if (model == models.end())
+        return "error: unknown model \"" + id + '"';
+    if (n <= 0)
+        return "error: iterations must be positive";
+
+    unique_ptr<Simulation> simulation;
+    if (overrides.empty())
+    {
+        lock_guard<mutex> guard(lock);
+        if (!model->second->idle.empty())
+        {
+            simulation = move(model->second->idle.back());
+            model->second->idle.pop_back();
+        }
+    }
+    try
+    {
+        if (!simulation)
+            simulation = build(*model->second, overrides);
+    }
+    catch (const invalid_argument& e)
+    {
+        return string("error: ") + e.what();
+    }
+
+    mt19937 gen(seed);
+    simulation->run(n, gen);
+    const shared_ptr<Component>& root = simulation->root;
+    pair<double, double> interval = root->mttf_interval(0.95);
+    ostringstream response;
+    response << "mean=" << convert_time(root->mttf(), units)
+             << " stddev=" << convert_time(root->stdttf(), units)
+             << " lower=" << convert_time(interval.first, units)
+             << " upper=" << convert_time(interval.second, units);
+
+    simulation->clear();
+    if (overrides.empty())
+    {
+        lock_guard<mutex> guard(lock);
+        model->second->idle.push_back(move(simulation));
+    }
+    return response.str();
+}
+
+/**
+ * Take the next request buffered from a connection that isn't waiting for a response
+ * and submit it to the pool, or close the connection if the client closed it and
+ * there is nothing left to answer.  A client that sends a line longer than
+ * Daemon::max_request is sent an error and disconnected.  Connections answer one request at a time so that
+ * responses come back in the order their requests were sent.
+ */
+void
+Daemon::dispatch(int connection, ThreadPool& pool)
+{
+    Connection& client = clients.at(connection);
+    while (true)
+    {
+        size_t end = client.buffer.find('\n');
+        if ((end == string::npos ? client.buffer.size() : end) > max_request)
+        {
+            // Don't keep buffering a request that will never be valid
+            string error = "error: request is longer than " + to_string(max_request) + " bytes\n";
+            if (send(connection, error.data(), error.size(), MSG_NOSIGNAL | MSG_DONTWAIT) < 0)
+                WARN("unable to reject request: %s\n", strerror(errno));
+            close(connection);
+            clients.erase(connection);
+            return;
+        }
+        if (end == string::npos)
+            break;
+
+        string request = client.buffer.substr(0, end);
+        client.buffer.erase(0, end + 1);
+        if (!request.empty() && request.back() == '\r')
+            request.pop_back();
+        if (request.empty())
+            continue;
+
+        client.busy = true;
+        pool.submit([this, connection, request](unsigned int){
+            string response = handle(request) + '\n';
+            bool sent = true;
+            for (size_t i = 0; sent && i < response.size();)
+            {
+                ssize_t s = send(connection, response.data() + i, response.size() - i, MSG_NOSIGNAL);
+                sent = s > 0;
+                i += max<ssize_t>(s, 0);
+            }
+            {
+                lock_guard<mutex> guard(finished_lock);
+                finished.emplace_back(connection, sent);
+            }
+            char c = 0;
+            while (write(wake[1], &c, 1) < 0 && errno == EINTR);
+        });
+        return;
+    }
+    if (client.closed)
+    {
+        close(connection);
+        clients.erase(connection);
+    }
+}
+
+/**
+ * Listen for connections on a UNIX domain socket at the given path (replacing
+ * anything already there) and serve their requests with the given pool.  One thread
+ * (this one) waits for connections and requests and submits each request as a job
+ * of its own, so any number of clients can stay connected without holding threads
+ * while they are idle.  This never returns.
+ */
+void
+Daemon::listen(const string& path, ThreadPool& pool)
+{
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0 || pipe(wake) < 0)
+    {
+        cerr << "error: unable to create socket: " << strerror(errno) << endl;
+        exit(1);
+    }
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        cerr << path << ": socket path is too long" << endl;
+        exit(1);
+    }
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    unlink(path.c_str());
+    if (bind(server, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(server, SOMAXCONN) < 0)
+    {
+        cerr << path << ": unable to listen: " << strerror(errno) << endl;
+        exit(1);
+    }
+    cout << "Listening on " << path << " with " << pool.size() << " threads" << endl;
+
+    vector<pollfd> fds;
+    while (true)
+    {
+        // Only wait on connections that aren't already waiting for a response
+        fds = {{server, POLLIN, 0}, {wake[0], POLLIN, 0}};
+        for (const auto& client: clients)
+            if (!client.second.busy)
+                fds.push_back({client.first, POLLIN, 0});
+        if (poll(fds.data(), fds.size(), -1) < 0)
+        {
+            if (errno != EINTR)
+                WARN("unable to wait for requests: %s\n", strerror(errno));
+            continue;
+        }
+
+        set<int> ready;
+        if (fds[1].revents)
+        {
+            char drain[256];
+            if (read(wake[0], drain, sizeof(drain)) < 0 && errno != EINTR)
+                WARN("unable to wait for responses: %s\n", strerror(errno));
+            lock_guard<mutex> guard(finished_lock);
+            for (const pair<int, bool>& f: finished)
+            {
+                Connection& client = clients.at(f.first);
+                client.busy = false;
+                if (!f.second)
+                {
+                    client.closed = true;
+                    client.buffer.clear();
+                }
+                ready.insert(f.first);
+            }
+            finished.clear();
+        }
+        for (size_t i = 2; i < fds.size(); i++)
+        {
+            if (!fds[i].revents)
+                continue;
+            Connection& client = clients.at(fds[i].fd);
+            char chunk[4096];
+            ssize_t received = recv(fds[i].fd, chunk, sizeof(chunk), 0);
+            if (received > 0)
+                client.buffer.append(chunk, received);
+            else if (received == 0 || errno != EINTR)
+                client.closed = true;
+            ready.insert(fds[i].fd);
+        }
+        if (fds[0].revents)
+        {
+            int connection = accept(server, nullptr, nullptr);
+            if (connection >= 0)
+                clients[connection] = Connection();
+            else if (errno != EINTR)
+                WARN("unable to accept connection: %s\n", strerror(errno));
+        }
+
+        for (int connection: ready)
+            if (!clients.at(connection).busy)
+                dispatch(connection, pool);
+    }
+}
+
+} // namespace oldspot
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <pugixml.hpp>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "failure.hh"
+#include "pool.hh"
+#include "simulation.hh"
+#include "unit.hh"
+
+namespace oldspot
+{
+
+/**
+ * Server that keeps systems loaded and simulates them on request over a UNIX domain
+ * socket, so that many small queries don't each pay for parsing configurations,
+ * loading traces, and computing reliability.  Each request is a line of
+ * whitespace-separated key=value pairs:
+ *
+ *    model=<id> [iterations=<n>] [seed=<s>] [<unit>.<quantity>=<value> ...]
+ *
+ * where the model ID is the path of a chip configuration the daemon was started with
+ * and each <unit>.<quantity> pair replaces a quantity with a constant in all of a
+ * unit's traces.  The response is a line with the mean, standard deviation, and 95%
+ * confidence interval of the system's lifetime, or a line starting with "error:".
+ * Lines longer than Daemon::max_request bytes are rejected with an error, and the
+ * connection is closed.
+ *
+ * One thread waits for requests on all connections and submits each one to a
+ * ThreadPool, answering a connection's requests in order.  Each simulation that runs at the
+ * same time needs its own copy of the system (see Simulation), so copies are kept
+ * for reuse once they are created; copies with overrides are built for each request
+ * from the model's already-computed reliability functions.
+ */
+class Daemon
+{
+  private:
+    struct Model
+    {
+        pugi::xml_document doc;
+        ReliabilityCache cache;
+        std::vector<std::unique_ptr<Simulation>> idle;
+    };
+
+    const std::set<std::shared_ptr<FailureMechanism>>& mechanisms;
+    size_t max_configurations;
+    bool lumping;
+    int iterations;
+    std::string units;
+    std::map<std::string, std::unique_ptr<Model>> models;
+    std::mutex lock;
+
+    /**
+     * Requests received from a client that haven't been answered yet, whether one
+     * of them is being answered, and whether the client has closed its end.
+     */
+    struct Connection
+    {
+        std::string buffer;
+        bool busy = false;
+        bool closed = false;
+    };
+
+    static const size_t max_request = 4096; // Longest request line, in bytes
+
+    std::map<int, Connection> clients;          // Only used by the listening thread
+    std::vector<std::pair<int, bool>> finished; // Answered connections and whether sending worked
+    std::mutex finished_lock;
+    int wake[2];                                // Pipe that wakes the listening thread up
+
+    std::unique_ptr<Simulation> build(Model& model, const std::map<std::pair<std::string, std::string>, double>& overrides);
+    std::string handle(const std::string& request);
+    void dispatch(int connection, ThreadPool& pool);
+
+  public:
+    Daemon(const std::vector<std::string>& configs, const std::set<std::shared_ptr<FailureMechanism>>& m,
+           size_t max_configs, bool lump, int n, const std::string& time_units, bool verbose=false);
+    void listen(const std::string& path, ThreadPool& pool);
+};
+
+} // namespace oldspot
@@ -0,0 +1,208 @@
+#include "dump.hh"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+namespace oldspot
+{
+
+using namespace std;
+
+const char TTFDump::magic[8] = {'O', 'L', 'D', 'S', 'P', 'O', 'T', '\0'};
+const uint32_t TTFDump::version;
+
+/**
+ * Create a dump file for the components with the given names, which are numbered in
+ * order, and start the thread that writes to it.
+ */
+TTFDump::TTFDump(const string& filename, const vector<string>& names)
+    : done(false), failed(false), name(filename)
+{
+    bool compress = filename.size() >= 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0;
+    file = gzopen(filename.c_str(), compress ? "wb1" : "wbT");
+    if (!file)
+    {
+        cerr << filename << ": unable to open file" << endl;
+        exit(1);
+    }
+    gzbuffer(file, capacity);
+
+    vector<char> buffer;
+    auto put = [&](const void* data, size_t size){
+        const char* bytes = (const char*)data;
+        buffer.insert(buffer.end(), bytes, bytes + size);
+    };
+    uint32_t n = names.size();
+    put(magic, sizeof(magic));
+    put(&version, sizeof(version));
+    put(&n, sizeof(n));
+    for (const string& name: names)
+    {
+        uint32_t length = name.size();
+        put(&length, sizeof(length));
+        put(name.data(), length);
+    }
+    full.push(move(buffer));
+    writer = thread(&TTFDump::work, this);
+}
+
+/**
+ * Wait for the writing thread to write everything that was submitted and close the
+ * file.
+ */
+TTFDump::~TTFDump()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        done = true;
+    }
+    ready.notify_one();
+    writer.join();
+    if (gzclose(file) != Z_OK || failed)
+        cerr << "error: could not write to " << name << endl;
+}
+
+/**
+ * Hand a buffer to the writing thread, waiting if it's too far behind, and replace
+ * it with an empty one.  Safe to call from any thread.
+ */
+void
+TTFDump::submit(vector<char>& buffer)
+{
+    unique_lock<mutex> guard(lock);
+    drained.wait(guard, [&]{ return full.size() < backlog; });
+    full.push(move(buffer));
+    if (spare.empty())
+    {
+        buffer = vector<char>();
+        buffer.reserve(capacity + sizeof(uint32_t) + sizeof(double));
+    }
+    else
+    {
+        buffer = move(spare.back());
+        spare.pop_back();
+    }
+    guard.unlock();
+    ready.notify_one();
+}
+
+/**
+ * Write buffers as they are handed over until the dump is closed.
+ */
+void
+TTFDump::work()
+{
+    unique_lock<mutex> guard(lock);
+    while (true)
+    {
+        ready.wait(guard, [&]{ return !full.empty() || done; });
+        if (full.empty())
+            return;
+        vector<char> data = move(full.front());
+        full.pop();
+        guard.unlock();
+
+        if (!data.empty() && !failed && gzwrite(file, data.data(), data.size()) != (int)data.size())
+            failed = true;
+        data.clear();
+
+        guard.lock();
+        spare.push_back(move(data));
+        drained.notify_one();
+    }
+}
+
+/**
+ * Read a dump file (compressed or not) written by TTFDump, setting names to the names
+ * of its components and calling record with the index of the component and the time
+ * to failure of each record in order.  Returns false, after reporting why, if the file
+ * can't be read or isn't a dump.
+ */
+bool
+readTTFDump(const string& filename, vector<string>& names, const function<void(uint32_t, double)>& record)
+{
+    gzFile file = gzopen(filename.c_str(), "rb");
+    if (!file)
+    {
+        cerr << filename << ": unable to open file" << endl;
+        return false;
+    }
+    gzbuffer(file, 1 << 20);
+    auto get = [&](void* data, size_t size){ return gzread(file, data, size) == (int)size; };
+
+    char magic[sizeof(TTFDump::magic)];
+    uint32_t version, n;
+    if (!get(magic, sizeof(magic)) || memcmp(magic, TTFDump::magic, sizeof(magic)) != 0
+        || !get(&version, sizeof(version)) || version != TTFDump::version || !get(&n, sizeof(n)))
+    {
+        cerr << filename << ": not a time-to-failure dump (or written on a machine with a different byte order)" << endl;
+        gzclose(file);
+        return false;
+    }
+    names.clear();
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint32_t length;
+        string name;
+        if (get(&length, sizeof(length)))
+        {
+            name.resize(length);
+            if (length == 0 || get(&name[0], length))
+            {
+                names.push_back(name);
+                continue;
+            }
+        }
+        cerr << filename << ": header ends early" << endl;
+        gzclose(file);
+        return false;
+    }
+
+    char chunk[(sizeof(uint32_t) + sizeof(double))*4096];
+    int size;
+    while ((size = gzread(file, chunk, sizeof(chunk))) > 0)
+    {
+        const size_t width = sizeof(uint32_t) + sizeof(double);
+        if (size%width != 0)
+        {
+            // Read the rest of a partial record, or give up if the file ends in one
+            int rest = gzread(file, chunk + size, width - size%width);
+            if (rest <= 0 || (size + rest)%width != 0)
+            {
+                cerr << filename << ": ends in the middle of a record" << endl;
+                gzclose(file);
+                return false;
+            }
+            size += rest;
+        }
+        for (int i = 0; i < size; i += width)
+        {
+            uint32_t component;
+            double t;
+            memcpy(&component, chunk + i, sizeof(component));
+            memcpy(&t, chunk + i + sizeof(component), sizeof(t));
+            if (component >= names.size())
+            {
+                cerr << filename << ": record for unknown component " << component << endl;
+                gzclose(file);
+                return false;
+            }
+            record(component, t);
+        }
+    }
+    gzclose(file);
+    if (size < 0)
+        cerr << filename << ": unable to read file" << endl;
+    return size == 0;
+}
+
+} // namespace oldspot
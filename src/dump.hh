@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+namespace oldspot
+{
+
+/**
+ * Binary file of times to failure that is written while simulating, as failures
+ * happen, so they don't have to be kept in memory or formatted as text.  Records are
+ * collected in buffers (one for each thread that simulates; see TTFDump::Buffer), and
+ * full buffers are handed to a thread that writes (and, if the file name ends in
+ * ".gz", compresses) them, so simulations only wait if several buffers are waiting to
+ * be written.  The file starts with a header:
+ *
+ *    "OLDSPOT\0", version (uint32), number of components n (uint32), and then n
+ *    names, each a length (uint32) followed by that many characters
+ *
+ * followed by a record for each failure: the index of the component in the header
+ * (uint32) and its time to failure in seconds (float64).  Records from different
+ * buffers are interleaved in blocks.  Numbers are in the byte order of the machine
+ * that wrote the file.
+ */
+class TTFDump
+{
+  private:
+    static const size_t capacity = 1 << 20;  // Bytes of records per buffer
+    static const size_t backlog = 4;         // Buffers waiting to be written before the simulation waits
+
+    gzFile file;
+    std::queue<std::vector<char>> full;
+    std::vector<std::vector<char>> spare;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::condition_variable drained;
+    bool done;
+    bool failed;
+    std::thread writer;
+    const std::string name;
+
+    void submit(std::vector<char>& buffer);
+    void work();
+
+  public:
+    static const char magic[8];
+    static const uint32_t version = 1;
+
+    /**
+     * Records from one thread, which are handed to the dump's writing thread whenever
+     * the buffer fills up and when it is destroyed, which must happen before the dump
+     * is.
+     */
+    class Buffer
+    {
+      private:
+        TTFDump& dump;
+        std::vector<char> records;
+
+      public:
+        Buffer(TTFDump& d) : dump(d) { records.reserve(capacity + sizeof(uint32_t) + sizeof(double)); }
+        ~Buffer() { dump.submit(records); }
+
+        void
+        write(uint32_t component, double t)
+        {
+            char record[sizeof(component) + sizeof(t)];
+            std::memcpy(record, &component, sizeof(component));
+            std::memcpy(record + sizeof(component), &t, sizeof(t));
+            records.insert(records.end(), record, record + sizeof(record));
+            if (records.size() >= capacity)
+                dump.submit(records);
+        }
+    };
+
+    TTFDump(const std::string& filename, const std::vector<std::string>& names);
+    ~TTFDump();
+};
+
+bool readTTFDump(const std::string& filename, std::vector<std::string>& names,
+                 const std::function<void(uint32_t, double)>& record);
+
+} // namespace oldspot
@@ -51,20 +51,20 @@ FailureMechanism::read_params(const string& file)
     if (f)
     {
         string line;
-        while (getline(f, line))
+        for (int n = 1; getline(f, line); n++)
         {
             if (line[0] != '#')
             {
                 vector<string> tokens = split(line, '\t');
                 if (tokens.size() != 2)
-                    warn("%s: %d: unable to parse line\n", file.c_str(), line);
+                    WARN("%s: %d: unable to parse line\n", file.c_str(), n);
                 else
                     params[tokens[0]] = stod(tokens[1]);
             }
         }
     }
     else
-        warn("%s: file not found\n", file.c_str());
+        WARN("%s: file not found\n", file.c_str());
     return params;
 }
 
@@ -106,7 +106,7 @@ NBTI::degradation(double t, double vdd, double dVth, double temperature, double
     double V = vdd - p.at("Vt0_p") - dVth;
     if (V < 0)
     {
-        warn("subthreshold VDD %f not supported; operating at threshold instead\n", vdd);
+        WARN("subthreshold VDD %f not supported; operating at threshold instead\n", vdd);
         V = 0;
     }
     double E_AIT = 2.0/3.0*(p.at("E_Akf") - p.at("E_Akr")) + p.at("E_ADH2")/6;
@@ -135,14 +135,14 @@ NBTI::timeToFailure(const DataPoint& data, double duty_cycle, double fail) const
         return numeric_limits<double>::infinity();
 
     // Create a linear approximation of dVth(t)
-    double dVth_fail = (data.data.at("vdd") - p.at("Vt0_p"))
-                       - (data.data.at("vdd") - p.at("Vt0_p"))/pow(1 + fail, 1/p.at("alpha")); // [3]
+    double dVth_fail = (data.at("vdd") - p.at("Vt0_p"))
+                       - (data.at("vdd") - p.at("Vt0_p"))/pow(1 + fail, 1/p.at("alpha")); // [3]
     double dVth = 0, dVth_prev = 0;
     double t = 0;
     for (; dVth < dVth_fail; t += dt)
     {
         dVth_prev = dVth;
-        dVth = degradation(t, data.data.at("vdd"), dVth, data.data.at("temperature"), duty_cycle);
+        dVth = degradation(t, data.at("vdd"), dVth, data.at("temperature"), duty_cycle);
     }
     t -= dt;
 
@@ -182,16 +182,16 @@ double
 EM::timeToFailure(const DataPoint& data, double, double) const
 {
     double j = 0;
-    if (data.data.count("current_density") != 0)
-        j = data.data.at("current_density");
-    else if (data.data.count("current") != 0)
-        j = data.data.at("current")/(p.at("w")*p.at("h"));
+    if (data.count("current_density") != 0)
+        j = data.at("current_density");
+    else if (data.count("current") != 0)
+        j = data.at("current")/(p.at("w")*p.at("h"));
     else
     {
-        warn("current density or current not found in trace data; approximating as P/V\n");
-        j = data.data.at("power")/data.data.at("vdd")/(p.at("w")*p.at("h"));
+        WARN("current density or current not found in trace data; approximating as P/V\n");
+        j = data.at("power")/data.at("vdd")/(p.at("w")*p.at("h"));
     }
-    return p.at("A")*pow(j, -p.at("n"))*exp(p.at("Ea")/(k_B*data.data.at("temperature")));
+    return p.at("A")*pow(j, -p.at("n"))*exp(p.at("Ea")/(k_B*data.at("temperature")));
 }
 
 /**
@@ -225,17 +225,17 @@ HCI::timeToFailure(const DataPoint& data, double duty_cycle, double fail) const
 {
     if (isnan(fail))
         fail = fail_default;
-    double vdd = data.data.at("vdd");
+    double vdd = data.at("vdd");
     double dVth_fail = (vdd - p.at("Vt0_n")) - (vdd - p.at("Vt0_n"))/pow(1 + fail, 1/p.at("alpha")); // [3]
 
-    double Vt = k_B/eV_J*data.data.at("temperature")/q;
+    double Vt = k_B/eV_J*data.at("temperature")/q;
     double vdsat = ((vdd - p.at("Vt0_n") + 2*Vt)*p.at("L")*p.at("Esat"))
                    /(vdd - p.at("Vt0_n") + 2*Vt + p.at("A_bulk")*p.at("L")*p.at("Esat"));
     double Em = (vdd - vdsat)/p.at("l");
     double Eox = (vdd - p.at("Vt0_n"))/p.at("tox");
     double A_HCI = q/p.at("Cox")*p.at("K")*sqrt(p.at("Cox")*(vdd - p.at("Vt0_n")));
     double t = pow(dVth_fail/(A_HCI*exp(Eox/p.at("E0"))*exp(-p.at("phi_it")/eV_J/(q*p.at("lambda")*Em))), 1/p.at("n"))
-               /(duty_cycle*data.data.at("frequency"));
+               /(duty_cycle*data.at("frequency"));
 
     return t;
 }
@@ -268,8 +268,8 @@ TDDB::TDDB(const string& tech_file, const string& tddb_file) : FailureMechanism(
 double
 TDDB::timeToFailure(const DataPoint& data, double, double) const
 {
-    double T = data.data.at("temperature");
-    return pow(data.data.at("vdd"), p.at("b")*T - p.at("a"))*exp((p.at("X") + p.at("Y")/T + p.at("Z")*T)/(k_B*T));
+    double T = data.at("temperature");
+    return pow(data.at("vdd"), p.at("b")*T - p.at("a"))*exp((p.at("X") + p.at("Y")/T + p.at("Z")*T)/(k_B*T));
 }
 
 } // namespace oldspot
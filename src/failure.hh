@@ -57,6 +57,12 @@ class FailureMechanism
     {
         return WeibullDistribution(beta, mttfs);
     }
+
+    virtual WeibullDistribution
+    distribution(const std::vector<CompactMTTFSegment>& mttfs) const
+    {
+        return WeibullDistribution(beta, mttfs);
+    }
 };
 
 /**
@@ -0,0 +1,212 @@
+#include "histogram.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "unit.hh"
+#include "util.hh"
+
+namespace oldspot
+{
+
+using namespace std;
+
+bool TTFHistogram::active = false;
+double TTFHistogram::low = 0;
+double TTFHistogram::high = 1;
+size_t TTFHistogram::bins = 1;
+bool TTFHistogram::logarithmic = false;
+vector<double> TTFHistogram::missions;
+
+/**
+ * Set up n bins between times lo and hi (which must be positive if they are
+ * logarithmically spaced) and the mission times at which to find R(t), and start
+ * counting failures in them.  Times are in seconds.
+ */
+void
+TTFHistogram::configure(double lo, double hi, size_t n, bool log, const vector<double>& m)
+{
+    low = lo;
+    high = hi;
+    bins = n;
+    logarithmic = log;
+    missions = m;
+    sort(missions.begin(), missions.end());
+    active = true;
+}
+
+/**
+ * Get the time at which bin i starts, or, for i equal to the number of bins, the time
+ * at which the last one ends.
+ */
+double
+TTFHistogram::edge(size_t i)
+{
+    if (logarithmic)
+        return low*pow(high/low, (double)i/bins);
+    else
+        return low + (high - low)*i/bins;
+}
+
+/**
+ * Count a failure at time t in its bin and in the first mission time it happens by.
+ */
+void
+TTFHistogram::count(double t)
+{
+    if (counts.empty())
+    {
+        counts.assign(bins + 2, 0);
+        failed.assign(missions.size(), 0);
+    }
+    double x = logarithmic ? log(t/low)/log(high/low) : (t - low)/(high - low);
+    counts[x < 0 ? 0 : x >= 1 ? bins + 1 : min((size_t)(x*bins), bins - 1) + 1]++;
+    size_t m = lower_bound(missions.begin(), missions.end(), t) - missions.begin();
+    if (m < missions.size())
+        failed[m]++;
+}
+
+/**
+ * Add the failures counted by another histogram to this one's.
+ */
+void
+TTFHistogram::merge(const TTFHistogram& other)
+{
+    if (other.counts.empty())
+        return;
+    if (counts.empty())
+    {
+        counts = other.counts;
+        failed = other.failed;
+        return;
+    }
+    for (size_t i = 0; i < counts.size(); i++)
+        counts[i] += other.counts[i];
+    for (size_t i = 0; i < failed.size(); i++)
+        failed[i] += other.failed[i];
+}
+
+/**
+ * Forget all counted failures.
+ */
+void
+TTFHistogram::clear()
+{
+    counts.clear();
+    failed.clear();
+}
+
+/**
+ * Estimate the reliability R(t) at mission time i as the fraction of the given number
+ * of iterations in which the component hadn't failed by then.  This is only unbiased
+ * if the component failed in every iteration (as the system does): units stop being
+ * simulated when the system fails, so a unit that didn't fail first would be counted
+ * as surviving past every mission time.
+ */
+double
+TTFHistogram::reliability(size_t i, size_t iterations) const
+{
+    if (failed.empty())
+        return 1;
+    return 1 - (double)accumulate(failed.begin(), failed.begin() + i + 1, (uint64_t)0)/iterations;
+}
+
+/**
+ * Write the histograms of the given components' times to failure and their R(t) at
+ * the mission times to a file, with times in the given units.  If the file name ends
+ * in ".json" it is written as a JSON object; otherwise it is a CSV table with a row
+ * for each component, whose columns are the number of failures before the first bin,
+ * in each bin (labeled with the time it starts), and after the last bin, followed by
+ * R(t) at each mission time.  R(t) is only given for components that failed in every
+ * iteration (see TTFHistogram::reliability); for the others it is null in JSON and
+ * empty in CSV.
+ */
+void
+writeHistograms(const string& filename, const vector<shared_ptr<Component>>& components,
+                size_t iterations, const string& units)
+{
+    ofstream file(filename);
+    if (!file)
+    {
+        cerr << "error: could not write to " << filename << endl;
+        return;
+    }
+    size_t bins = TTFHistogram::size();
+    const vector<double>& missions = TTFHistogram::mission_times();
+
+    if (filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0)
+    {
+        auto quote = [](const string& s){
+            string quoted = "\"";
+            for (char c: s)
+            {
+                if (c == '"' || c == '\\')
+                    quoted += '\\';
+                quoted += c;
+            }
+            return quoted + '"';
+        };
+        file << "{\"units\":" << quote(units) << ",\"iterations\":" << iterations << ",\"edges\":[";
+        for (size_t i = 0; i <= bins; i++)
+            file << (i > 0 ? "," : "") << convert_time(TTFHistogram::edge(i), units);
+        file << "],\"missions\":[";
+        for (size_t i = 0; i < missions.size(); i++)
+            file << (i > 0 ? "," : "") << convert_time(missions[i], units);
+        file << "],\"components\":{";
+        for (size_t c = 0; c < components.size(); c++)
+        {
+            const TTFHistogram& histogram = components[c]->histogram;
+            file << (c > 0 ? "," : "") << quote(components[c]->name) << ":{\"failures\":" << components[c]->failures()
+                 << ",\"below\":" << histogram.below() << ",\"counts\":[";
+            for (size_t i = 0; i < bins; i++)
+                file << (i > 0 ? "," : "") << histogram.in(i);
+            file << "],\"above\":" << histogram.above() << ",\"reliability\":";
+            if (components[c]->failures() == iterations)
+            {
+                file << '[';
+                for (size_t i = 0; i < missions.size(); i++)
+                    file << (i > 0 ? "," : "") << histogram.reliability(i, iterations);
+                file << ']';
+            }
+            else
+                file << "null";
+            file << '}';
+        }
+        file << "}}" << endl;
+    }
+    else
+    {
+        file << ",below";
+        for (size_t i = 0; i < bins; i++)
+            file << ',' << convert_time(TTFHistogram::edge(i), units);
+        file << ",above";
+        for (double mission: missions)
+            file << ",R(" << convert_time(mission, units) << ')';
+        file << endl;
+        for (const shared_ptr<Component>& component: components)
+        {
+            const TTFHistogram& histogram = component->histogram;
+            file << component->name << ',' << histogram.below();
+            for (size_t i = 0; i < bins; i++)
+                file << ',' << histogram.in(i);
+            file << ',' << histogram.above();
+            for (size_t i = 0; i < missions.size(); i++)
+            {
+                file << ',';
+                if (component->failures() == iterations)
+                    file << histogram.reliability(i, iterations);
+            }
+            file << endl;
+        }
+    }
+}
+
+} // namespace oldspot
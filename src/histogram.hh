@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace oldspot
+{
+
+class Component;
+
+/**
+ * Counts of a component's times to failure in fixed bins, which are either evenly or
+ * logarithmically spaced between two times, along with how many of them fall below
+ * and above those times and how many fall by each of a set of mission times.  They
+ * are accumulated as failures happen, so the shape of the distribution (and R(t) at
+ * the mission times) is available without keeping the samples.  The bins and mission
+ * times are shared by all components and are set with TTFHistogram::configure before
+ * simulating.
+ */
+class TTFHistogram
+{
+  private:
+    static bool active;
+    static double low;
+    static double high;
+    static size_t bins;
+    static bool logarithmic;
+    static std::vector<double> missions;
+
+    std::vector<uint64_t> counts;  // Below the first bin, in each bin, and then above the last
+    std::vector<uint64_t> failed;  // After the previous mission time and by each one
+
+    void count(double t);
+
+  public:
+    static void configure(double lo, double hi, size_t n, bool log, const std::vector<double>& m);
+    static bool enabled() { return active; }
+    static size_t size() { return bins; }
+    static double edge(size_t i);
+    static const std::vector<double>& mission_times() { return missions; }
+
+    void add(double t) { if (active) count(t); }
+    void merge(const TTFHistogram& other);
+    void clear();
+    uint64_t below() const { return counts.empty() ? 0 : counts.front(); }
+    uint64_t above() const { return counts.empty() ? 0 : counts.back(); }
+    uint64_t in(size_t i) const { return counts.empty() ? 0 : counts[i + 1]; }
+    double reliability(size_t i, size_t iterations) const;
+};
+
+void writeHistograms(const std::string& filename, const std::vector<std::shared_ptr<Component>>& components,
+                     size_t iterations, const std::string& units);
+
+} // namespace oldspot
@@ -14,6 +14,7 @@
 #include <pugixml.hpp>
 #include <random>
 #include <set>
+#include <stdexcept>
 #include <string>
 #include <tclap/CmdLine.h>
 #include <unordered_map>
@@ -21,7 +22,13 @@
 #include <utility>
 #include <vector>
 
+#include "daemon.hh"
+#include "dump.hh"
 #include "failure.hh"
+#include "histogram.hh"
+#include "pool.hh"
+#include "sequences.hh"
+#include "simulation.hh"
 #include "trace.hh"
 #include "unit.hh"
 #include "util.hh"
@@ -30,39 +37,6 @@ using namespace oldspot;
 using namespace pugi;
 using namespace std;
 
-inline bool
-node_is(const xml_node& node, const string& type)
-{
-    return strcmp(node.attribute("type").value(), type.c_str()) == 0;
-}
-
-// Assumes time is already in seconds
-inline double
-convert_time(double time, const string& units)
-{
-    if (units == "seconds")
-        return time;
-    time /= 60;
-    if (units == "minutes")
-        return time;
-    time /= 60;
-    if (units == "hours")
-        return time;
-    time /= 24;
-    if (units == "days")
-        return time;
-    time /= 7;
-    if (units == "weeks")
-        return time;
-    time /= 4;
-    if (units == "months")
-        return time;
-    time /= 12;
-    if (units == "years")
-        return time;
-    throw invalid_argument("unknown time unit \"" + units + '"');
-}
-
 int
 main(int argc, char* argv[])
 {
@@ -70,24 +44,62 @@ main(int argc, char* argv[])
 
     vector<string> time_units{"seconds", "minutes", "hours", "days", "weeks", "months", "years"};
     ValuesConstraint<string> time_constraint(time_units);
+    vector<string> fallbacks{"fresh", "subset"};
+    ValuesConstraint<string> fallback_constraint(fallbacks);
+    vector<string> samplers{"unit", "competing"};
+    ValuesConstraint<string> sampler_constraint(samplers);
+    vector<string> formats{"text", "binary"};
+    ValuesConstraint<string> format_constraint(formats);
+    vector<string> scales{"linear", "log"};
+    ValuesConstraint<string> scale_constraint(scales);
 
     set<shared_ptr<FailureMechanism>> mechanisms;
     xml_document doc;
 
     CmdLine cmd("Compute the reliability distribution of a chip", ' ', "0.1");
     SwitchArg verbose("v", "verbose", "Display progress output", cmd);
+    SwitchArg no_lumping("", "no-lumping", "Simulate each unit separately even if some are exchangeable", cmd);
+    SwitchArg collapse("", "collapse-static", "Simulate groups whose units don't depend on the rest of the system as single units (units in them get no times to failure)", cmd);
     ValueArg<string> tddb("", "tddb-parameters", "File containing model parameters for TDDB", false, "", "filename", cmd);
     ValueArg<string> hci("", "hci-parameters", "File containing model parameters for HCI", false, "", "filename", cmd);
     ValueArg<string> em("", "em-parameters", "File containing model parameters for electromigration", false, "", "filename", cmd);
     ValueArg<string> nbti("", "nbti-parameters", "File containing model parameters for NBTI", false, "", "filename", cmd);
     ValueArg<string> technology("", "technology-file", "File containing technology constants for aging mechanisms", false, "", "filename", cmd);
     ValueArg<string> phenomena("", "aging-mechanisms", "Comma-separated list of aging mechanisms to include or \"all\" for all of them", false, "all", "mechanisms", cmd);
+    ValueArg<unsigned int> max_warnings("", "max-warnings", "Number of times each warning can be issued before it is suppressed (default: 10)", false, 10, "count", cmd);
+    ValueArg<int> max_configs("", "max-configurations", "Maximum number of sets of failed units to explore when resolving configurations before simulating (default: 4096)", false, 4096, "sets", cmd);
+    ValueArg<string> fallback("", "config-fallback", "Trace to use when a unit has none for the current configuration: \"fresh\" or the closest declared \"subset\" (default: fresh)", false, "fresh", &fallback_constraint, cmd);
+    ValueArg<double> tolerance("", "trace-tolerance", "Aggregate adjacent trace segments as long as an estimate of the relative error this adds to each aging rate stays within this value; the estimate is not a guaranteed bound (default: 0, no aggregation)", false, 0, "error", cmd);
+    SwitchArg piecewise("", "piecewise-aging", "Age units faster or slower according to where they are in their traces and profiles (of repeated phases) instead of at their average rates", cmd);
+    ValueArg<string> stream("", "stream", "Read rows of unit name, time, and values for the fresh configuration from a file or FIFO (- for standard input) as they are produced, in place of units' fresh traces", false, "", "filename", cmd);
+    ValueArg<string> daemon("", "daemon", "Keep the chip configuration and any given with --model loaded and serve simulation requests on a UNIX domain socket at this path", false, "", "socket", cmd);
+    MultiArg<string> models("", "model", "Additional chip configuration to serve in daemon mode", false, "filename", cmd);
+    ValueArg<unsigned int> threads("", "threads", "Number of threads loading models and serving requests in daemon mode, in place of --jobs (default: 0, one per hardware thread)", false, 0, "threads", cmd);
+    ValueArg<unsigned int> stream_interval("", "stream-interval", "Print running aging rates of all units after every this many streamed rows (default: 0, never)", false, 0, "rows", cmd);
+    ValueArg<string> sampler("", "sampler", "How to find the next failure: sample each \"unit\" and take the earliest or sample the system's \"competing\" risks with one draw (default: unit)", false, "unit", &sampler_constraint, cmd);
+    ValueArg<unsigned int> lanes("", "lanes", "Number of Monte Carlo iterations to simulate in lockstep when iterations never leave the enumerated states (default: 1)", false, 1, "iterations", cmd);
+    ValueArg<unsigned int> jobs("j", "jobs", "Number of threads for loading traces, computing reliability, and running iterations (default: 1; 0 for one per hardware thread)", false, 1, "threads", cmd);
+    ValueArg<unsigned int> chunk("", "chunk-size", "Number of Monte Carlo iterations each thread runs at a time when there are several (default: 1000)", false, 1000, "iterations", cmd);
+    SwitchArg pin("", "pin-threads", "Pin each thread from --jobs to a CPU, spreading them evenly over NUMA nodes", cmd);
+    SwitchArg replicate("", "replicate-model", "Give each NUMA node its own copy of units' reliability functions for running iterations, and add up results on each node before combining them (implies --pin-threads)", cmd);
+    ValueArg<string> stats("", "stats-json", "Write how many chunks of work each thread ran and stole and how long it was idle to file as JSON", false, "", "filename", cmd);
+    SwitchArg single("", "single-precision", "Store values read from trace files as single-precision floats, which halves the memory they take", cmd);
     ValueArg<char> delimiter("", "trace-delimiter", "One-character delimiter for data in input trace files (default: ,)", false, ',', "delim", cmd);
     ValueArg<string> time("", "time-units", "Units for displaying time to failure (default: hours)", false, "hours", &time_constraint, cmd);
-    ValueArg<string> separate("", "mechanism-aging-rates", "Write per-mechanism aging rates for each unit to file (only works for fresh configuration)", false, "", "filename", cmd);
+    ValueArg<string> separate("", "mechanism-aging-rates", "Write per-mechanism aging rates for each unit in the fresh configuration to file, along with how many of its failures each mechanism caused and their mean time", false, "", "filename", cmd);
     ValueArg<string> dist_dump("", "dump-ttfs", "Dump time-to-failure distribution to file", false, "", "filename", cmd);
+    ValueArg<string> dump_format("", "dump-format", "Format of the time-to-failure dump: \"text\" or \"binary\", which is written during the simulation and compressed if the file name ends in .gz (default: text)", false, "text", &format_constraint, cmd);
+    ValueArg<string> histogram("", "histogram", "Write histograms of the times to failure of the system and each unit, and the reliability at mission times of the system and of units that failed in every iteration, to file (JSON if its name ends in .json, CSV otherwise)", false, "", "filename", cmd);
+    ValueArg<unsigned int> bins("", "histogram-bins", "Number of histogram bins (default: 50)", false, 50, "bins", cmd);
+    ValueArg<string> range("", "histogram-range", "Start of the first histogram bin and end of the last (default: from 0, or 1/1000 of the smallest unit aging rate if logarithmic, to 3 times the largest)", false, "", "min,max", cmd);
+    ValueArg<string> scale("", "histogram-scale", "Spacing of histogram bins: \"linear\" or \"log\" (default: linear)", false, "linear", &scale_constraint, cmd);
+    ValueArg<string> sequences("", "failure-sequences", "Write the most common orders in which units fail before the system does, with their probabilities and the system's mean time to failure after each, to file as CSV", false, "", "filename", cmd);
+    ValueArg<unsigned int> top("", "top-sequences", "Number of failure sequences to write (default: 10)", false, 10, "sequences", cmd);
+    ValueArg<unsigned int> counters("", "sequence-counters", "Number of failure sequences to track while simulating; more makes counts of rare sequences more accurate (default: 1000)", false, 1000, "counters", cmd);
+    ValueArg<string> missions("", "mission-times", "Comma-separated times at which to estimate reliability for the histogram file", false, "", "times", cmd);
     ValueArg<string> rates("", "unit-aging-rates", "Write per-unit aging rates, MTTFs, and failure counts to file (aging rates only for fresh configuration)", false, "", "filename", cmd);
     ValueArg<int> iterations("n", "iterations", "Number of Monte-Carlo iterations to perform (default: 1000)", false, 1000, "iterations", cmd);
+    ValueArg<unsigned long> seed("", "seed", "Seed for the random number generator, to repeat a simulation (default: random)", false, 0, "seed", cmd);
     UnlabeledValueArg<string> config("chip-config", "File containing chip configuration", true, "", "filename", cmd);
 
     try
@@ -108,7 +120,53 @@ main(int argc, char* argv[])
         return 1;
     }
 
+    Diagnostic::limit = max_warnings.getValue();
     Unit::delim = delimiter.getValue();
+    Trace::single_precision = single.getValue();
+    Unit::fallback = fallback.getValue() == "subset" ? Unit::Fallback::SUBSET : Unit::Fallback::FRESH;
+    if (tolerance.getValue() < 0)
+    {
+        cerr << "error: trace tolerance must be nonnegative" << endl;
+        return 1;
+    }
+    Unit::tolerance = tolerance.getValue();
+    Unit::piecewise = piecewise.getValue();
+    Simulation::sampler = sampler.getValue() == "competing" ? Simulation::Sampler::COMPETING : Simulation::Sampler::UNIT;
+    Simulation::collapse = collapse.getValue();
+    if (lanes.getValue() == 0)
+    {
+        cerr << "error: need at least one lane" << endl;
+        return 1;
+    }
+    Simulation::lanes = lanes.getValue();
+    Simulation::attribution = !separate.getValue().empty();
+    if (!sequences.getValue().empty())
+    {
+        if (counters.getValue() == 0)
+        {
+            cerr << "error: failure sequences need at least one counter" << endl;
+            return 1;
+        }
+        FailureSequences::configure(max(counters.getValue(), top.getValue()));
+    }
+    if (chunk.getValue() == 0)
+    {
+        cerr << "error: chunks need at least one iteration" << endl;
+        return 1;
+    }
+    unique_ptr<ThreadPool> pool;
+    if (!daemon.getValue().empty())
+    {
+        // Requests are served by the same pool that loads the models
+        pool.reset(new ThreadPool(threads.isSet() || !jobs.isSet() ? threads.getValue() : jobs.getValue(), pin.getValue()));
+        Simulation::pool = pool.get();
+    }
+    else if (jobs.getValue() != 1 || !stats.getValue().empty() || pin.getValue() || replicate.getValue())
+    {
+        pool.reset(new ThreadPool(jobs.getValue(), pin.getValue() || replicate.getValue()));
+        Simulation::pool = pool.get();
+        pool->phase("load");
+    }
 
     transform(phenomena.getValue().begin(), phenomena.getValue().end(), phenomena.getValue().begin(), ::tolower);
     for (const string& token: split(phenomena.getValue(), ','))
@@ -122,7 +180,7 @@ main(int argc, char* argv[])
         if (token == "tddb" || token == "all")
             mechanisms.insert(make_shared<TDDB>(technology.getValue(), tddb.getValue()));
         if (token != "all" && token != "nbti" && token != "em" && token != "hci" && token != "tddb")
-            warn("ignoring unknown aging mechanism \"%s\"\n", token.c_str());
+            WARN("ignoring unknown aging mechanism \"%s\"\n", token.c_str());
     }
     if (mechanisms.empty())
     {
@@ -130,88 +188,187 @@ main(int argc, char* argv[])
         return 1;
     }
 
-    if (verbose.getValue())
-        cout << "Creating units..." << endl;
-    vector<shared_ptr<Unit>> units;
-    for (const xml_node& child: doc.children("unit"))
+    if (!daemon.getValue().empty())
     {
-        if (node_is(child, "unit"))
-            units.push_back(make_shared<Unit>(child, units.size()));
-        else if (node_is(child, "core"))
-            units.push_back(make_shared<Core>(child, units.size()));
-        else if (node_is(child, "logic"))
-            units.push_back(make_shared<Logic>(child, units.size()));
-        else if (node_is(child, "memory"))
-            units.push_back(make_shared<Memory>(child, units.size()));
-        else
+        if (!stream.getValue().empty())
         {
-            cerr << "unknown unit type \"" << child.attribute("type").value()
-                 << "\" for unit " << child.attribute("name").value() << endl;
-            exit(1);
+            cerr << "error: streamed traces can't be used in daemon mode" << endl;
+            return 1;
         }
+        vector<string> configs = models.getValue();
+        configs.insert(configs.begin(), config.getValue());
+        Daemon server(configs, mechanisms, max_configs.getValue(), !no_lumping.getValue(),
+                      iterations.getValue(), time.getValue(), verbose.getValue());
+        server.listen(daemon.getValue(), *pool);
     }
-    if (verbose.getValue())
-        cout << "Creating failure dependency graph..." << endl;
-    shared_ptr<Component> root = make_shared<Group>(doc.child("group"), units);
 
-    if (verbose.getValue())
-        cout << "Computing aging rates..." << endl;
-    for (const shared_ptr<Unit>& unit: units)
-        unit->compute_reliability(mechanisms);
+    Simulation simulation(doc, max_configs.getValue(), verbose.getValue());
+    const vector<shared_ptr<Unit>>& units = simulation.units;
+    const shared_ptr<Component>& root = simulation.root;
 
-    // Monte Carlo sim to get overall failure distribution
-    for (int i = 0; i < iterations.getValue(); i++)
+    if (!stream.getValue().empty())
     {
         if (verbose.getValue())
-            cout << "Beginning Monte Carlo iteration " << i << endl;
+            cout << "Reading streamed trace rows..." << endl;
+        ifstream file;
+        if (stream.getValue() != "-")
+        {
+            file.open(stream.getValue());
+            if (!file)
+            {
+                cerr << stream.getValue() << ": unable to open file" << endl;
+                return 1;
+            }
+        }
+        TraceStream rows(stream.getValue() == "-" ? cin : file, delimiter.getValue());
 
-        unordered_set<shared_ptr<Component>> failed_components;
-        unordered_set<shared_ptr<Unit>> healthy(units.begin(), units.end());
-        double t = 0;
-        for (shared_ptr<Unit>& unit: units)
-            unit->reset();
-        while (!root->failed())
+        unordered_map<string, shared_ptr<Unit>> named;
+        for (const shared_ptr<Unit>& unit: units)
+            named[unit->name] = unit;
+        if (stream_interval.getValue() > 0)
         {
+            cout << "time";
             for (const shared_ptr<Unit>& unit: units)
-                if (!unit->failed())
-                    unit->set_configuration(root);
+                cout << ',' << unit->name;
+            cout << endl;
+        }
 
-            double dt_event = numeric_limits<double>::infinity();
-            shared_ptr<Unit> failed;
-            for (const shared_ptr<Unit>& unit: healthy)
+        string name;
+        double when;
+        unordered_map<string, double> values;
+        size_t count = 0;
+        while (rows.next(name, when, values))
+        {
+            auto unit = named.find(name);
+            if (unit == named.end())
             {
-                double dt = unit->get_next_event();
-                if (dt_event > dt)
-                {
-                    failed = unit;
-                    dt_event = dt;
-                }
+                WARN("ignoring streamed row for unknown unit %s\n", name.c_str());
+                continue;
             }
-            
-            if (isinf(dt_event))
+            unit->second->stream(when, values, mechanisms);
+            if (stream_interval.getValue() > 0 && ++count%stream_interval.getValue() == 0)
             {
-                warn("no unit failure during iteration %d\n", i);
-                break;
+                cout << when;
+                for (const shared_ptr<Unit>& u: units)
+                    cout << ',' << convert_time(u->streamed_rate(), time.getValue());
+                cout << endl;
             }
+        }
+    }
 
-            for (const shared_ptr<Unit>& unit: healthy)
-                unit->update_reliability(dt_event);
-            failed->failure();
-            if (failed->failed())
-                healthy.erase(healthy.find(failed));
-            t += dt_event;
+    ReliabilityCache cache;
+    if (pool)
+        pool->phase("reliability");
+    AggregationStatistics aggregation = simulation.prepare(mechanisms, cache, !no_lumping.getValue());
+    if (tolerance.getValue() > 0)
+        cout << "Evaluated aging at " << aggregation.evaluations << " points for " << aggregation.segments
+             << " trace segments (estimated relative error in aging rates at most " << aggregation.error
+             << "; this is an estimate, not a bound)" << endl;
 
-            Component::walk(root, [&](const shared_ptr<Component>& c) {
-                if (c->failed() && failed_components.count(c) == 0)
+    if (!histogram.getValue().empty())
+    {
+        // Times are given in the display units
+        double seconds = 1/convert_time(1, time.getValue());
+        bool log = scale.getValue() == "log";
+        vector<double> bounds, mission_times;
+        try
+        {
+            if (!range.getValue().empty())
+                for (const string& token: split(range.getValue(), ','))
+                    bounds.push_back(stod(token)*seconds);
+            if (!missions.getValue().empty())
+                for (const string& token: split(missions.getValue(), ','))
+                    mission_times.push_back(stod(token)*seconds);
+        }
+        catch (const logic_error&)
+        {
+            cerr << "error: histogram range and mission times must be numbers" << endl;
+            return 1;
+        }
+        if (bounds.empty())
+        {
+            double shortest = numeric_limits<double>::infinity(), longest = 0;
+            for (const shared_ptr<Unit>& unit: units)
+            {
+                double alpha = unit->aging_rate();
+                if (alpha > 0 && isfinite(alpha))
                 {
-                    c->ttfs.push_back(t);
-                    failed_components.insert(c);
+                    shortest = min(shortest, alpha);
+                    longest = max(longest, alpha);
                 }
+            }
+            if (longest == 0)
+            {
+                cerr << "error: no unit ages, so a histogram range is needed" << endl;
+                return 1;
+            }
+            bounds = {log ? shortest/1000 : 0, 3*longest};
+        }
+        if (bounds.size() != 2 || bounds[0] >= bounds[1] || (log && bounds[0] <= 0) || bins.getValue() == 0)
+        {
+            cerr << "error: histogram needs at least one bin and a range with min < max (and min > 0 if logarithmic)" << endl;
+            return 1;
+        }
+        TTFHistogram::configure(bounds[0], bounds[1], bins.getValue(), log, mission_times);
+    }
+
+    // Monte Carlo sim to get overall failure distribution, spread over a copy of the
+    // system for each thread if there are several.  Each thread creates its own copy,
+    // after the first thread on each node creates the one the others on the node copy
+    // if the model is replicated.
+    vector<unique_ptr<Simulation>> copies;
+    vector<Simulation*> simulations{&simulation};
+    if (pool)
+    {
+        pool->phase("simulation");
+        copies.resize(pool->size());
+        for (bool leads: {true, false})
+        {
+            pool->each([&](unsigned int w){
+                if ((pool->lead(w) == w) != leads)
+                    return;
+                if (replicate.getValue())
+                    copies[w].reset(leads ? new Simulation(simulation, doc, true) : new Simulation(*copies[pool->lead(w)], doc));
+                else
+                    copies[w].reset(new Simulation(simulation, doc));
+                copies[w]->prepare(mechanisms, cache, !no_lumping.getValue());
             });
-            for (const shared_ptr<Unit>& unit: Unit::parents_failed(root, units))
-                failed_components.insert(unit);
         }
+        simulations.clear();
+        for (const unique_ptr<Simulation>& copy: copies)
+            simulations.push_back(copy.get());
     }
+
+    bool binary = !dist_dump.getValue().empty() && dump_format.getValue() == "binary";
+    Component::keep = !dist_dump.getValue().empty() && !binary;
+    unique_ptr<TTFDump> dump;
+    vector<unique_ptr<TTFDump::Buffer>> buffers;
+    if (binary)
+    {
+        vector<string> names{root->name};
+        for (const shared_ptr<Unit>& unit: units)
+            names.push_back(unit->name);
+        dump.reset(new TTFDump(dist_dump.getValue(), names));
+        for (Simulation* s: simulations)
+        {
+            vector<shared_ptr<Component>> components{s->root};
+            components.insert(components.end(), s->units.begin(), s->units.end());
+            buffers.emplace_back(new TTFDump::Buffer(*dump));
+            for (size_t i = 0; i < components.size(); i++)
+            {
+                components[i]->dump_file = buffers.back().get();
+                components[i]->channel = i;
+            }
+        }
+    }
+    mt19937 gen(seed.isSet() ? seed.getValue() : random_device()());
+    if (pool)
+        simulation.run(iterations.getValue(), gen, copies, chunk.getValue());
+    else
+        simulation.run(iterations.getValue(), gen);
+    buffers.clear();
+    dump.reset();
+
     cout << "Lifetime statistics for " << root->name << endl;
     cout << "Mean: " << convert_time(root->mttf(), time.getValue()) << endl;
     cout << "Standard deviation: " << convert_time(root->stdttf(), time.getValue()) << endl;
@@ -222,19 +379,25 @@ main(int argc, char* argv[])
     {
         unordered_map<string, function<double(const shared_ptr<Unit>&)>> outputs = {
             {"mttf", [&](const shared_ptr<Unit>& u){ return convert_time(u->mttf(), time.getValue()); }},
-            {"failures", [](const shared_ptr<Unit>& u){ return u->ttfs.size(); }},
+            {"failures", [](const shared_ptr<Unit>& u){ return u->failures(); }},
             {"alpha", [&](const shared_ptr<Unit>& u){ return convert_time(u->aging_rate(), time.getValue()); }}
         };
         writecsv(rates.getValue(), units, outputs);
     }
     if (!separate.getValue().empty())
     {
-        unordered_map<string, function<double(const shared_ptr<Unit>&)>> outputs;
+        vector<pair<string, function<double(const shared_ptr<Unit>&)>>> outputs;
+        size_t m = 0;
         for (const shared_ptr<FailureMechanism>& mechanism: mechanisms)
-            outputs[mechanism->name] = [&](const shared_ptr<Unit>& u){ return convert_time(u->aging_rate(mechanism), time.getValue()); };
+        {
+            outputs.emplace_back(mechanism->name, [&, mechanism](const shared_ptr<Unit>& u){ return convert_time(u->aging_rate(mechanism), time.getValue()); });
+            outputs.emplace_back(mechanism->name + " failures", [m](const shared_ptr<Unit>& u){ return u->attributed(m); });
+            outputs.emplace_back(mechanism->name + " mttf", [&, m](const shared_ptr<Unit>& u){ return convert_time(u->attributed_mttf(m), time.getValue()); });
+            m++;
+        }
         writecsv(separate.getValue(), units, outputs);
     }
-    if (!dist_dump.getValue().empty())
+    if (!dist_dump.getValue().empty() && !binary)
     {
         ofstream dist(dist_dump.getValue());
         if (dist)
@@ -254,6 +417,16 @@ main(int argc, char* argv[])
         else
             cerr << "error: could not write to " << dist_dump.getValue() << endl;
     }
+    if (!histogram.getValue().empty())
+    {
+        vector<shared_ptr<Component>> components{root};
+        components.insert(components.end(), units.begin(), units.end());
+        writeHistograms(histogram.getValue(), components, iterations.getValue(), time.getValue());
+    }
+    if (!sequences.getValue().empty())
+        writeFailureSequences(sequences.getValue(), simulation.sequences, simulation.names(), top.getValue(), iterations.getValue(), time.getValue());
+    if (!stats.getValue().empty())
+        pool->write(stats.getValue());
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,361 @@
+#include "pool.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "util.hh"
+
+namespace oldspot
+{
+
+using namespace std;
+
+// Pool and index of the worker running on this thread, if it is one
+static thread_local ThreadPool* owner = nullptr;
+static thread_local unsigned int worker_index = 0;
+
+/**
+ * Find the CPUs this process may run on, grouped by NUMA node in order of node and
+ * then CPU number.  Machines (or systems) that don't describe their nodes are treated
+ * as having a single node.
+ */
+static vector<vector<int>>
+topology()
+{
+    vector<vector<int>> nodes;
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return nodes;
+    for (int n = 0;; n++)
+    {
+        ifstream file("/sys/devices/system/node/node" + to_string(n) + "/cpulist");
+        if (!file)
+            break;
+        string list;
+        getline(file, list);
+        vector<int> cpus;
+        for (const string& range: split(list, ','))
+        {
+            if (range.empty())
+                continue;
+            size_t dash = range.find('-');
+            int first = stoi(range.substr(0, dash));
+            int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                    cpus.push_back(cpu);
+        }
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+    if (nodes.empty())
+    {
+        nodes.emplace_back();
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed))
+                nodes.back().push_back(cpu);
+    }
+#endif
+    return nodes;
+}
+
+/**
+ * Start the given number of worker threads, or one per hardware thread if it's 0.  If
+ * pin is set, each worker is pinned to a CPU, spreading them evenly over NUMA nodes.
+ */
+ThreadPool::ThreadPool(unsigned int threads, bool pin)
+    : task(nullptr), remaining(0), done(0), batch(0), stopping(false), stealing(true)
+{
+    if (threads == 0)
+        threads = max(thread::hardware_concurrency(), 1U);
+    for (unsigned int i = 0; i < threads; i++)
+        queues.emplace_back(new Queue);
+    cpus.assign(threads, -1);
+    nodes.assign(threads, 0);
+    if (pin)
+    {
+        vector<vector<int>> machine = topology();
+        vector<pair<int, unsigned int>> available; // CPU and its node
+        for (unsigned int n = 0; n < machine.size(); n++)
+            for (int cpu: machine[n])
+                available.emplace_back(cpu, n);
+        if (available.empty())
+            WARN("can't pin threads to CPUs on this system\n");
+        for (unsigned int w = 0; w < threads && !available.empty(); w++)
+        {
+            // Consecutive workers share a node when there are fewer workers than CPUs
+            size_t i = threads <= available.size() ? w*available.size()/threads : w%available.size();
+            cpus[w] = available[i].first;
+            nodes[w] = available[i].second;
+        }
+    }
+    totals.resize(threads);
+    marks.resize(threads);
+    since = clock::now();
+    for (unsigned int i = 0; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+/**
+ * Stop the workers once they are done with any run in progress.  Submitted jobs that
+ * haven't started are dropped.
+ */
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    started.notify_all();
+    for (thread& worker: workers)
+        worker.join();
+}
+
+/**
+ * Get the first worker on the same NUMA node as worker w.
+ */
+unsigned int
+ThreadPool::lead(unsigned int w) const
+{
+    return find(nodes.begin(), nodes.end(), nodes[w]) - nodes.begin();
+}
+
+/**
+ * Call f(begin, end, w) for chunks [begin, end) of at most the given size that
+ * together cover [0, n), where w is the index of the worker that runs the chunk, and
+ * wait for them to finish.  Runs from different threads take turns, and a run started
+ * from inside one of this pool's chunks runs all of its chunks on the calling worker.
+ */
+void
+ThreadPool::run(size_t n, size_t chunk, const task_t& f)
+{
+    if (n == 0)
+        return;
+    chunk = max<size_t>(chunk, 1);
+    if (owner == this)
+    {
+        for (size_t begin = 0; begin < n; begin += chunk)
+            f(begin, min(begin + chunk, n), worker_index);
+        return;
+    }
+
+    start(n, chunk, f, true);
+}
+
+/**
+ * Call f(w) once on each worker w, and wait for them all to finish, so that what f
+ * allocates is local to the worker's NUMA node if it's pinned.  Like ThreadPool::run,
+ * this can't be called from inside a chunk.
+ */
+void
+ThreadPool::each(const function<void(unsigned int)>& f)
+{
+    start(workers.size(), 1, [&](size_t, size_t, unsigned int w){ f(w); }, false);
+}
+
+/**
+ * Queue f to be called as f(w) by the next worker w that is free, and return without
+ * waiting for it.  Chunks of a run that f starts all run on that worker.
+ */
+void
+ThreadPool::submit(const job_t& f)
+{
+    {
+        lock_guard<mutex> guard(lock);
+        jobs.push_back(f);
+    }
+    started.notify_one();
+}
+
+/**
+ * Deal chunks of the range [0, n) to the workers and wait for them to finish, letting
+ * workers take chunks dealt to others if steal is set.
+ */
+void
+ThreadPool::start(size_t n, size_t chunk, const task_t& f, bool steal)
+{
+    lock_guard<mutex> turn(running);
+    size_t chunks = (n + chunk - 1)/chunk;
+    for (size_t w = 0; w < queues.size(); w++)
+    {
+        lock_guard<mutex> guard(queues[w]->lock);
+        for (size_t c = chunks*w/queues.size(); c < chunks*(w + 1)/queues.size(); c++)
+            queues[w]->chunks.emplace_back(c*chunk, min((c + 1)*chunk, n));
+    }
+    unique_lock<mutex> guard(lock);
+    task = &f;
+    stealing = steal;
+    remaining = chunks;
+    done = 0;
+    batch++;
+    started.notify_all();
+    finished.wait(guard, [&]{ return done == workers.size(); });
+    task = nullptr;
+}
+
+/**
+ * Take the next chunk for worker w, from the back of its own queue or else from the
+ * front of another worker's, setting stolen if it came from another worker.  Returns
+ * false if there are no chunks left to take.
+ */
+bool
+ThreadPool::take(unsigned int w, pair<size_t, size_t>& chunk, bool& stolen)
+{
+    for (size_t i = 0; i < (stealing ? queues.size() : 1); i++)
+    {
+        Queue& queue = *queues[(w + i)%queues.size()];
+        lock_guard<mutex> guard(queue.lock);
+        if (queue.chunks.empty())
+            continue;
+        if (i == 0)
+        {
+            chunk = queue.chunks.back();
+            queue.chunks.pop_back();
+        }
+        else
+        {
+            chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+        }
+        stolen = i > 0;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Run chunks as worker w whenever a run starts, and then wait for the other workers'
+ * chunks to finish, and run submitted jobs in between runs, until the pool is
+ * destroyed.
+ */
+void
+ThreadPool::work(unsigned int w)
+{
+    owner = this;
+    worker_index = w;
+#ifdef __linux__
+    if (cpus[w] >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpus[w], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            WARN("unable to pin thread to CPU %d\n", cpus[w]);
+    }
+#endif
+    uint64_t seen = 0;
+    unique_lock<mutex> guard(lock);
+    while (true)
+    {
+        started.wait(guard, [&]{ return stopping || batch != seen || !jobs.empty(); });
+        if (stopping)
+            return;
+        if (batch == seen)
+        {
+            job_t job = move(jobs.front());
+            jobs.pop_front();
+            guard.unlock();
+            job(w);
+            guard.lock();
+            totals[w].tasks++;
+            continue;
+        }
+        seen = batch;
+        const task_t& f = *task;
+        guard.unlock();
+
+        Statistics& stats = totals[w];
+        pair<size_t, size_t> chunk;
+        bool stolen;
+        while (take(w, chunk, stolen))
+        {
+            f(chunk.first, chunk.second, w);
+            stats.tasks++;
+            stats.steals += stolen;
+            guard.lock();
+            if (--remaining == 0)
+                finished.notify_all();
+            guard.unlock();
+        }
+
+        clock::time_point idle = clock::now();
+        guard.lock();
+        finished.wait(guard, [&]{ return remaining == 0; });
+        stats.idle += chrono::duration<double>(clock::now() - idle).count();
+        if (++done == workers.size())
+            finished.notify_all();
+    }
+}
+
+/**
+ * Start counting statistics for a new phase of the program with the given name,
+ * ending the current one.  An empty name ends the current phase without starting
+ * another.  This shouldn't be called during a run.
+ */
+void
+ThreadPool::phase(const string& name)
+{
+    clock::time_point now = clock::now();
+    if (!current.empty())
+    {
+        Phase ended{current, chrono::duration<double>(now - since).count(), totals};
+        for (size_t w = 0; w < totals.size(); w++)
+        {
+            ended.workers[w].tasks -= marks[w].tasks;
+            ended.workers[w].steals -= marks[w].steals;
+            ended.workers[w].idle -= marks[w].idle;
+        }
+        phases.push_back(ended);
+    }
+    marks = totals;
+    current = name;
+    since = now;
+}
+
+/**
+ * End the current phase and write the statistics of each worker in each phase so far
+ * to a file as a JSON object.
+ */
+void
+ThreadPool::write(const string& filename)
+{
+    phase("");
+    ofstream file(filename);
+    if (!file)
+    {
+        cerr << "error: could not write to " << filename << endl;
+        return;
+    }
+    file << "{\"threads\":" << workers.size() << ",\"phases\":[";
+    for (size_t p = 0; p < phases.size(); p++)
+    {
+        file << (p > 0 ? "," : "") << "{\"name\":\"" << phases[p].name << "\",\"seconds\":" << phases[p].seconds << ",\"workers\":[";
+        for (size_t w = 0; w < phases[p].workers.size(); w++)
+        {
+            const Statistics& stats = phases[p].workers[w];
+            file << (w > 0 ? "," : "") << "{\"tasks\":" << stats.tasks << ",\"steals\":" << stats.steals
+                 << ",\"idle\":" << stats.idle << '}';
+        }
+        file << "]}";
+    }
+    file << "]}" << endl;
+}
+
+} // namespace oldspot
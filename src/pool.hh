@@ -0,0 +1,107 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace oldspot
+{
+
+/**
+ * Pool of worker threads that share out ranges of indices.  Each call to
+ * ThreadPool::run splits a range into chunks and deals contiguous runs of them to
+ * the workers' own queues; a worker takes chunks from the back of its own queue and,
+ * once that's empty, steals them from the front of the others', so workers that get
+ * cheap chunks help the ones that get expensive chunks instead of waiting for them.
+ *
+ * Workers can be pinned to CPUs, spread evenly over the machine's NUMA nodes so that
+ * consecutive workers share a node, so that memory a worker allocates (see
+ * ThreadPool::each) stays on its node.
+ *
+ * Independent jobs can also be submitted with ThreadPool::submit without waiting for
+ * them; workers run them one at a time between runs, so a run started while jobs are
+ * in progress waits for the workers running them to finish their current jobs.
+ *
+ * Each worker counts the chunks (and jobs) it runs, how many of them it stole, and how long it
+ * spent idle while a run was in progress, accumulated for each phase of the program
+ * (see ThreadPool::phase) and written with ThreadPool::write.
+ */
+class ThreadPool
+{
+  public:
+    struct Statistics
+    {
+        uint64_t tasks = 0;
+        uint64_t steals = 0;
+        double idle = 0; // Seconds
+    };
+
+  private:
+    typedef std::function<void(size_t, size_t, unsigned int)> task_t;
+    typedef std::function<void(unsigned int)> job_t;
+    typedef std::chrono::steady_clock clock;
+
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<std::pair<size_t, size_t>> chunks;
+    };
+
+    /**
+     * Statistics of each worker during one phase of the program.
+     */
+    struct Phase
+    {
+        std::string name;
+        double seconds;
+        std::vector<Statistics> workers;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::mutex lock;
+    std::condition_variable started;
+    std::condition_variable finished;
+    std::mutex running;
+    const task_t* task;
+    std::deque<job_t> jobs;
+    size_t remaining;
+    unsigned int done;
+    uint64_t batch;
+    bool stopping;
+    bool stealing;
+    std::vector<int> cpus;           // CPU each worker is pinned to, or -1
+    std::vector<unsigned int> nodes; // NUMA node of each worker
+
+    std::vector<Statistics> totals;
+    std::vector<Statistics> marks;
+    std::string current;
+    clock::time_point since;
+    std::vector<Phase> phases;
+
+    void start(size_t n, size_t chunk, const task_t& f, bool steal);
+    bool take(unsigned int w, std::pair<size_t, size_t>& chunk, bool& stolen);
+    void work(unsigned int w);
+
+  public:
+    ThreadPool(unsigned int threads, bool pin=false);
+    ~ThreadPool();
+    unsigned int size() const { return workers.size(); }
+    unsigned int node(unsigned int w) const { return nodes[w]; }
+    unsigned int lead(unsigned int w) const;
+    void run(size_t n, size_t chunk, const task_t& f);
+    void each(const std::function<void(unsigned int)>& f);
+    void submit(const job_t& f);
+    void phase(const std::string& name);
+    void write(const std::string& filename);
+};
+
+} // namespace oldspot
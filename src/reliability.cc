@@ -5,7 +5,6 @@
 #include <cstddef>
 #include <functional>
 #include <iostream>
-#include <iterator>
 #include <limits>
 #include <numeric>
 #include <stdexcept>
@@ -32,36 +31,42 @@ WeibullDistribution::estimate(const std::vector<double>& ttfs, double beta)
 }
 
 /**
- * Create a Weibull distribution using the given set of time-varying mean-times-to-failure,
- * computed using:
+ * Compute the average rate of failure over a set of time-varying mean-times-to-failure,
+ * accumulating in double precision however the segments are stored, using:
  * [1] Y. Xiang, T. Chantem, R. P. Dick, X. S. Hu and L. Shang, "System-
  *     level reliability modeling for MPSoCs," 2010 IEEE/ACM/IFIP International
  *     Conference on Hardware/Software Codesign and System Synthesis (CODES+ISSS),
  *     Scottsdale, AZ, 2010, pp. 297-306.
  */
-WeibullDistribution::WeibullDistribution(double b, const vector<MTTFSegment>& mttfs)
-    : WeibullDistribution(1, b)
-{
-    // Convert MTTFs into rate parameters
-    vector<double> alphas;
-    alphas.reserve(mttfs.size());
-    transform(mttfs.begin(), mttfs.end(), back_inserter(alphas),
-              [this](const MTTFSegment& a){ return a.mttf/tgamma(1/beta + 1); });
-    
-    // Accumulate rates into average rate [1]
-    alpha = 0.0;
+template<typename Segment>
+static double
+average_rate(const vector<Segment>& mttfs)
+{
+    double rate = 0.0;
     double total_time = 0.0;
-    for (const MTTFSegment& mttf: mttfs)
+    for (const Segment& mttf: mttfs)
     {
-        alpha += mttf.duration/mttf.mttf;
+        rate += (double)mttf.duration/mttf.mttf;
         total_time += mttf.duration;
     }
-    alpha /= total_time;
-
-    // Invert to resemble actual Weibull alpha
-    alpha = 1/alpha;
+    return rate/total_time;
 }
 
+/**
+ * Create a Weibull distribution using the given set of time-varying mean-times-to-failure.
+ */
+WeibullDistribution::WeibullDistribution(double b, const vector<MTTFSegment>& mttfs)
+    : WeibullDistribution(1/average_rate(mttfs), b)
+{}
+
+/**
+ * Create a Weibull distribution using the given set of time-varying mean-times-to-failure
+ * stored in single precision.
+ */
+WeibullDistribution::WeibullDistribution(double b, const vector<CompactMTTFSegment>& mttfs)
+    : WeibullDistribution(1/average_rate(mttfs), b)
+{}
+
 /**
  * Compute the time it takes to get to a particular reliabilty value with this
  * Weibull distribution's parameters.
@@ -99,4 +104,191 @@ WeibullDistribution::operator=(const WeibullDistribution& other)
     return *this;
 }
 
+/**
+ * Lay out the aging rates of a mission profile's phases.  A profile that ages at the
+ * same rate throughout, or that doesn't age (or fails immediately), is uniform, in
+ * which case a device's age is simply the time.
+ */
+AgingSchedule::AgingSchedule(const vector<MTTFPhase>& phases)
+    : period(0), _uniform(true)
+{
+    double damage = 0;
+    for (const MTTFPhase& phase: phases)
+    {
+        phase_times.push_back(period);
+        phase_ages.push_back(damage);
+        repeats.push_back(max(phase.repeat, 1));
+        firsts.push_back(times.size());
+        double length = 0, span = 0;
+        for (const MTTFSegment& segment: phase.segments)
+        {
+            times.push_back(length);
+            ages.push_back(span);
+            rates.push_back(1/segment.mttf);
+            length += segment.duration;
+            span += segment.duration/segment.mttf;
+            _uniform = _uniform && rates.back() == rates.front();
+        }
+        lengths.push_back(length);
+        spans.push_back(span);
+        period += repeats.back()*length;
+        damage += repeats.back()*span;
+    }
+    firsts.push_back(times.size());
+
+    double mean = damage/period;
+    if (!(mean > 0 && isfinite(mean)))
+        _uniform = true;
+    if (_uniform)
+        return;
+    for (vector<double>* v: {&phase_ages, &spans, &ages, &rates})
+        for (double& x: *v)
+            x /= mean;
+}
+
+/**
+ * Find the segment that a point within a run through the profile falls in, measured
+ * either in time or in age (by passing the corresponding starts and lengths of phases
+ * and segments), and set phase to its phase and run to the number of earlier runs of
+ * that phase's trace.
+ */
+size_t
+AgingSchedule::find(double x, const vector<double>& phase_starts, const vector<double>& runs,
+                    const vector<double>& starts, size_t& phase, double& run) const
+{
+    phase = max<ptrdiff_t>(upper_bound(phase_starts.begin(), phase_starts.end(), x) - phase_starts.begin() - 1, 0);
+    double y = x - phase_starts[phase];
+    run = runs[phase] > 0 ? max(min(floor(y/runs[phase]), repeats[phase] - 1.0), 0.0) : 0;
+    auto begin = starts.begin() + firsts[phase], end = starts.begin() + firsts[phase + 1];
+    return max<ptrdiff_t>(upper_bound(begin, end, y - run*runs[phase]) - starts.begin() - 1, firsts[phase]);
+}
+
+/**
+ * Compute the effective age A(t) at time t.
+ */
+double
+AgingSchedule::age(double t) const
+{
+    if (_uniform || !isfinite(t))
+        return t;
+    double n = floor(t/period), x = t - n*period, run;
+    size_t phase, i = find(x, phase_times, lengths, times, phase, run);
+    double offset = x - phase_times[phase] - run*lengths[phase] - times[i];
+    return n*period + phase_ages[phase] + run*spans[phase] + ages[i] + rates[i]*offset;
+}
+
+/**
+ * Find the time at which the effective age reaches a.
+ */
+double
+AgingSchedule::time(double a) const
+{
+    if (_uniform || !isfinite(a))
+        return a;
+    double n = floor(a/period), x = a - n*period, run;
+    size_t phase, i = find(x, phase_ages, spans, ages, phase, run);
+    double offset = x - phase_ages[phase] - run*spans[phase] - ages[i];
+    return n*period + phase_times[phase] + run*lengths[phase] + times[i] + (rates[i] > 0 ? offset/rates[i] : 0);
+}
+
+/**
+ * Compute the rate A'(t) at which the effective age increases at time t.
+ */
+double
+AgingSchedule::rate(double t) const
+{
+    if (_uniform || !isfinite(t))
+        return 1;
+    double n = floor(t/period), run;
+    size_t phase;
+    return rates[find(t - n*period, phase_times, lengths, times, phase, run)];
+}
+
+const size_t TabulatedReliability::points;
+constexpr double TabulatedReliability::negligible;
+
+/**
+ * Tabulate a reliability function given its cumulative hazard H(t) = -ln(R(t)),
+ * which should be accurate even where R(t) is very close to 0 or 1.  The table
+ * extends to about the time at which H reaches TabulatedReliability::negligible.
+ */
+TabulatedReliability::TabulatedReliability(const function<double(double)>& cumulative_hazard)
+    : step(1), hazards(points, 0), exponents(points, 1), first(points - 1)
+{
+    // Find the end of the table by doubling or halving, giving up if H stays 0 (in
+    // which case failure is impossible) or is immediately reached
+    double end = 1;
+    for (int i = 0; i < 2048 && cumulative_hazard(end) < negligible && isfinite(2*end); i++)
+        end *= 2;
+    for (int i = 0; i < 2048 && cumulative_hazard(end/2) >= negligible && end/2 > 0; i++)
+        end /= 2;
+    step = end/(points - 1);
+
+    for (size_t i = 1; i < points; i++)
+    {
+        // Past the point where R underflows, H only matters for staying nondecreasing
+        hazards[i] = min(cumulative_hazard(i*step), 700.0);
+        if (hazards[i] > 0 && first == points - 1)
+            first = i;
+    }
+    for (size_t i = first; i < points - 1; i++)
+    {
+        double k = log(hazards[i + 1]/hazards[i])/log((i + 1.0)/i);
+        exponents[i] = k > 0 && isfinite(k) ? k : 1;
+    }
+}
+
+/**
+ * Find the index of the interval of the table used to interpolate H at or after
+ * the time with the given index.  Times before the first nonzero value use the
+ * first interval and times after the end of the table use the last one.
+ */
+size_t
+TabulatedReliability::cell(size_t i) const
+{
+    return max(first, min(i, points - 2));
+}
+
+/**
+ * Compute the cumulative hazard H(t) = -ln(R(t)) at time t.
+ */
+double
+TabulatedReliability::hazard(double t) const
+{
+    if (first >= points - 1 || t <= 0)
+        return 0;
+    double x = t/step;
+    size_t i = cell(x < points ? (size_t)x : points);
+    return hazards[i]*pow(x/i, exponents[i]);
+}
+
+/**
+ * Compute the hazard rate h(t) = H'(t), the instantaneous rate of failure at time t
+ * given survival until then.
+ */
+double
+TabulatedReliability::hazard_rate(double t) const
+{
+    if (first >= points - 1 || t <= 0)
+        return 0;
+    double x = t/step;
+    size_t i = cell(x < points ? (size_t)x : points);
+    return exponents[i]*hazard(t)/t;
+}
+
+/**
+ * Find the time at which the cumulative hazard reaches h, or infinity if failure
+ * is impossible.
+ */
+double
+TabulatedReliability::inverse_hazard(double h) const
+{
+    if (first >= points - 1)
+        return numeric_limits<double>::infinity();
+    if (h <= 0)
+        return 0;
+    size_t i = cell(upper_bound(hazards.begin(), hazards.end(), h) - hazards.begin() - 1);
+    return step*i*pow(h/hazards[i], 1/exponents[i]);
+}
+
 } // namespace oldspot
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <functional>
 #include <vector>
 
 namespace oldspot
@@ -16,6 +17,27 @@ struct MTTFSegment
     double mttf;
 };
 
+/**
+ * MTTFSegment stored in single precision, for the segments of traces read with
+ * Trace::single_precision, which would otherwise take twice the memory of the trace
+ * values themselves while they are reduced to a rate.
+ */
+struct CompactMTTFSegment
+{
+    float duration;
+    float mttf;
+};
+
+/**
+ * Phase of a mission profile described by the MTTF over each segment of its trace
+ * and the number of times in a row the trace runs.
+ */
+struct MTTFPhase
+{
+    std::vector<MTTFSegment> segments;
+    int repeat;
+};
+
 /**
  * The Weibull distribution is a method for representing the failure probability of a
  * device over time (or, equivalently, the the fraction of surviving devices within a
@@ -49,11 +71,15 @@ class WeibullDistribution
     WeibullDistribution() : WeibullDistribution(1, 1) {}
     WeibullDistribution(const WeibullDistribution& other) : WeibullDistribution(other.alpha, other.beta) {}
     WeibullDistribution(double b, const std::vector<MTTFSegment>& mttfs);
+    WeibullDistribution(double b, const std::vector<CompactMTTFSegment>& mttfs);
 
     double reliability(double t) const { return std::exp(-std::pow(t/alpha, beta)); }
+    double cumulative_hazard(double t) const { return std::pow(t/alpha, beta); }
+    double hazard(double t) const { return beta/alpha*std::pow(t/alpha, beta - 1); }
     double inverse(double r) const;
     double mttf() const { return alpha*std::tgamma(1/beta + 1); }
     double rate() const { return alpha; }
+    double shape() const { return beta; }
 
     double operator()(double t) const { return reliability(t); }
     WeibullDistribution operator*(const WeibullDistribution& other) const;
@@ -61,4 +87,82 @@ class WeibullDistribution
     WeibullDistribution& operator*=(const WeibullDistribution& other) { return *this = (*this)*other; }
 };
 
+/**
+ * Effective age of a device over time when its aging rate varies over a repeating
+ * mission profile instead of being averaged over it.  Each segment of each phase's
+ * trace ages the device at a rate inversely proportional to its MTTF, scaled so that
+ * a whole run through the profile adds its length to the age.  The device's
+ * reliability at time t is then that of its averaged Weibull distribution at age A(t),
+ * which agrees with the averaged distribution at the end of every run.  Ages at the
+ * start of each phase, and of each segment within a run of its trace, are stored as
+ * prefix sums, so A(t) and its inverse each take a binary search over phases and
+ * another over one trace's segments.
+ */
+class AgingSchedule
+{
+  private:
+    double period;
+    bool _uniform;
+
+    // For each phase, the time and age at which it starts, the length of and age added
+    // by one run of its trace, the number of runs, and the index of its first segment
+    std::vector<double> phase_times;
+    std::vector<double> phase_ages;
+    std::vector<double> lengths;
+    std::vector<double> spans;
+    std::vector<int> repeats;
+    std::vector<size_t> firsts;
+
+    // For each segment, the time and age since the start of its run at which it
+    // starts and the rate of aging during it
+    std::vector<double> times;
+    std::vector<double> ages;
+    std::vector<double> rates;
+
+    size_t find(double x, const std::vector<double>& phase_starts, const std::vector<double>& runs,
+                const std::vector<double>& starts, size_t& phase, double& run) const;
+
+  public:
+    AgingSchedule() : period(1), _uniform(true) {}
+    AgingSchedule(const std::vector<MTTFPhase>& phases);
+
+    bool uniform() const { return _uniform; }
+    double age(double t) const;
+    double time(double a) const;
+    double rate(double t) const;
+};
+
+/**
+ * Reliability function that isn't Weibull (e.g. that of a group of units that can
+ * tolerate some failures), represented by its cumulative hazard H(t) = -ln(R(t))
+ * at evenly-spaced times up to where the reliability is negligible.  Between those
+ * times, and before and after them, H is interpolated as a power of t, which is
+ * exact for Weibull distributions and is asymptotically exact near t = 0 for the
+ * reliability of any group of Weibull-distributed units.
+ */
+class TabulatedReliability
+{
+  private:
+    double step;
+    std::vector<double> hazards;
+    std::vector<double> exponents; // Power of t that H grows with starting at each time
+    size_t first;                  // First time at which H is nonzero (points - 1 if none)
+
+    size_t cell(size_t i) const;
+
+  public:
+    static const size_t points = 1024;
+    static constexpr double negligible = 40; // Cumulative hazard at which R ~ 4e-18
+
+    // Reliability of something that never fails, which needs no table
+    TabulatedReliability() : step(1), first(points - 1) {}
+    TabulatedReliability(const std::function<double(double)>& cumulative_hazard);
+
+    double hazard(double t) const;
+    double hazard_rate(double t) const;
+    double inverse_hazard(double h) const;
+    double reliability(double t) const { return std::exp(-hazard(t)); }
+    double inverse(double r) const { return inverse_hazard(-std::log(r)); }
+};
+
 } // namespace oldspot
\ No newline at end of file
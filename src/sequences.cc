@@ -0,0 +1,247 @@
+#include "sequences.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "util.hh"
+
+namespace oldspot
+{
+
+using namespace std;
+
+bool FailureSequences::active = false;
+size_t FailureSequences::capacity = 0;
+
+/**
+ * Hash a sequence of failure IDs with 64-bit FNV-1a.
+ */
+size_t
+FailureSequences::Hash::operator()(const sequence_t& s) const
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (uint32_t id: s)
+    {
+        h ^= id;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * Swap the counters at positions i and j of the heap.
+ */
+void
+FailureSequences::swap(size_t i, size_t j)
+{
+    std::swap(heap[i], heap[j]);
+    positions[heap[i]] = i;
+    positions[heap[j]] = j;
+}
+
+/**
+ * Move the counter at position i of the heap toward the root until its parent's
+ * count is no larger.
+ */
+void
+FailureSequences::up(size_t i)
+{
+    while (i > 0 && counters[heap[(i - 1)/2]].count > counters[heap[i]].count)
+    {
+        swap(i, (i - 1)/2);
+        i = (i - 1)/2;
+    }
+}
+
+/**
+ * Move the counter at position i of the heap away from the root until neither of its
+ * children has a smaller count.
+ */
+void
+FailureSequences::down(size_t i)
+{
+    while (true)
+    {
+        size_t smallest = i;
+        for (size_t child = 2*i + 1; child <= 2*i + 2 && child < heap.size(); child++)
+            if (counters[heap[child]].count < counters[heap[smallest]].count)
+                smallest = child;
+        if (smallest == i)
+            return;
+        swap(i, smallest);
+        i = smallest;
+    }
+}
+
+/**
+ * Get the most times a sequence that isn't tracked could have happened, which is the
+ * smallest count if all of the counters are in use and 0 otherwise.
+ */
+uint64_t
+FailureSequences::floor() const
+{
+    return counters.size() < capacity || heap.empty() ? 0 : counters[heap.front()].count;
+}
+
+/**
+ * Count an iteration in which units failed in the given sequence and the system
+ * failed at time t.
+ */
+void
+FailureSequences::count(const sequence_t& sequence, double t)
+{
+    auto found = index.find(sequence);
+    size_t c;
+    if (found != index.end())
+        c = found->second;
+    else if (counters.size() < capacity)
+    {
+        c = counters.size();
+        counters.push_back({&index.emplace(sequence, c).first->first, 0, 0, 0, 0});
+        heap.push_back(c);
+        positions.push_back(heap.size() - 1);
+    }
+    else
+    {
+        // Replace the sequence with the smallest count, which is the most this one
+        // could have happened without being tracked
+        c = heap.front();
+        index.erase(*counters[c].sequence);
+        counters[c] = {&index.emplace(sequence, c).first->first, counters[c].count, counters[c].count, 0, 0};
+    }
+
+    Counter& counter = counters[c];
+    counter.count++;
+    counter.observed++;
+    counter.sum += t;
+    if (counter.count == 1)
+        up(positions[c]);
+    else
+        down(positions[c]);
+}
+
+/**
+ * Add the sequences counted by another summary (e.g. from a copy of the system that
+ * was simulated at the same time) to this one's, keeping the ones with the largest
+ * combined counts.  A sequence that only one summary tracks may have happened as
+ * many times as the other's smallest count, which is added to its count and error, as
+ * in:
+ * [1] Agarwal, P. K., Cormode, G., Huang, Z., Phillips, J. M., Wei, Z., and Yi, K.
+ *     Mergeable summaries.  PODS 2012.
+ */
+void
+FailureSequences::merge(const FailureSequences& other)
+{
+    if (other.counters.empty())
+        return;
+    uint64_t mine = floor(), theirs = other.floor();
+    vector<pair<sequence_t, Counter>> merged;
+    for (const Counter& counter: counters)
+    {
+        merged.emplace_back(*counter.sequence, counter);
+        auto found = other.index.find(*counter.sequence);
+        Counter& combined = merged.back().second;
+        if (found == other.index.end())
+        {
+            combined.count += theirs;
+            combined.error += theirs;
+            continue;
+        }
+        const Counter& matched = other.counters[found->second];
+        combined.count += matched.count;
+        combined.error += matched.error;
+        combined.observed += matched.observed;
+        combined.sum += matched.sum;
+    }
+    for (const Counter& counter: other.counters)
+    {
+        if (index.count(*counter.sequence) > 0)
+            continue;
+        merged.emplace_back(*counter.sequence, counter);
+        merged.back().second.count += mine;
+        merged.back().second.error += mine;
+    }
+    sort(merged.begin(), merged.end(), [](const pair<sequence_t, Counter>& a, const pair<sequence_t, Counter>& b){
+        return a.second.count > b.second.count;
+    });
+    merged.resize(min(merged.size(), capacity));
+
+    clear();
+    for (const pair<sequence_t, Counter>& entry: merged)
+    {
+        size_t c = counters.size();
+        counters.push_back(entry.second);
+        counters.back().sequence = &index.emplace(entry.first, c).first->first;
+        heap.push_back(c);
+        positions.push_back(c);
+    }
+    for (size_t i = heap.size()/2; i-- > 0;)
+        down(i);
+}
+
+/**
+ * Forget all counted sequences.
+ */
+void
+FailureSequences::clear()
+{
+    counters.clear();
+    heap.clear();
+    positions.clear();
+    index.clear();
+}
+
+/**
+ * Get the counters of the (at most) k sequences with the largest counts, from largest
+ * to smallest.
+ */
+vector<FailureSequences::Counter>
+FailureSequences::top(size_t k) const
+{
+    vector<Counter> sorted = counters;
+    k = min(k, sorted.size());
+    partial_sort(sorted.begin(), sorted.begin() + k, sorted.end(), [](const Counter& a, const Counter& b){
+        return make_tuple(a.count, b.error) > make_tuple(b.count, a.error);
+    });
+    sorted.resize(k);
+    return sorted;
+}
+
+/**
+ * Write the top sequences counted by a summary to a CSV file, with the names of the
+ * units (or collapsed groups) for each failure ID and the number of iterations that
+ * were counted.  Each row gives a sequence with its names separated by " > ", its
+ * estimated count and the most it could be over by, the fraction of iterations it
+ * happened in, and the mean time to failure of the system when it happened (in the
+ * given units) over the iterations since its counter was last assigned to it.
+ */
+void
+writeFailureSequences(const string& filename, const FailureSequences& sequences, const vector<string>& names,
+                      size_t top, size_t iterations, const string& units)
+{
+    ofstream file(filename);
+    if (!file)
+    {
+        cerr << "error: could not write to " << filename << endl;
+        return;
+    }
+    file << "sequence,count,error,probability,mttf" << endl;
+    for (const FailureSequences::Counter& counter: sequences.top(top))
+    {
+        for (size_t i = 0; i < counter.sequence->size(); i++)
+            file << (i > 0 ? " > " : "") << names[(*counter.sequence)[i]];
+        double mttf = counter.observed > 0 ? counter.sum/counter.observed : numeric_limits<double>::quiet_NaN();
+        file << ',' << counter.count << ',' << counter.error << ',' << (double)counter.count/iterations
+             << ',' << convert_time(mttf, units) << endl;
+    }
+}
+
+} // namespace oldspot
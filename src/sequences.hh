@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace oldspot
+{
+
+/**
+ * Approximate counts of the most common orders in which units fail before the
+ * system does, kept with the space-saving algorithm [1] so that memory is bounded by
+ * the number of counters rather than the number of iterations.  Each counter tracks
+ * one sequence of failure IDs (see Simulation::names); a sequence that isn't tracked
+ * takes over the counter with the smallest count and inherits that count as its
+ * error, so counts are overestimates by at most their error, and any sequence that
+ * happens in more than 1/counters of the iterations is guaranteed to be tracked.
+ * Each counter also sums the system's time to failure over the iterations since its
+ * sequence started being tracked.  The number of counters is shared by all systems
+ * and is set with FailureSequences::configure before simulating.
+ *
+ * [1] Metwally, A., Agrawal, D., and El Abbadi, A. Efficient computation of frequent
+ *     and top-k elements in data streams.  ICDT 2005.
+ */
+class FailureSequences
+{
+  public:
+    typedef std::vector<uint32_t> sequence_t;
+
+    /**
+     * Counter for one sequence: its estimated count, the most that estimate could be
+     * over by, and the number and sum of system times to failure seen since it was
+     * last assigned to the sequence.
+     */
+    struct Counter
+    {
+        const sequence_t* sequence;
+        uint64_t count;
+        uint64_t error;
+        uint64_t observed;
+        double sum;
+    };
+
+  private:
+    struct Hash
+    {
+        size_t operator()(const sequence_t& s) const;
+    };
+
+    static bool active;
+    static size_t capacity;
+
+    std::vector<Counter> counters;
+    std::vector<size_t> heap;       // Counters ordered as a min-heap on their counts
+    std::vector<size_t> positions;  // Position of each counter in the heap
+    std::unordered_map<sequence_t, size_t, Hash> index;
+
+    void swap(size_t i, size_t j);
+    void up(size_t i);
+    void down(size_t i);
+    uint64_t floor() const;
+
+  public:
+    static void configure(size_t n) { capacity = n; active = true; }
+    static bool enabled() { return active; }
+
+    void count(const sequence_t& sequence, double t);
+    void merge(const FailureSequences& other);
+    void clear();
+    std::vector<Counter> top(size_t k) const;
+};
+
+void writeFailureSequences(const std::string& filename, const FailureSequences& sequences, const std::vector<std::string>& names,
+                           size_t top, size_t iterations, const std::string& units);
+
+} // namespace oldspot
@@ -0,0 +1,1200 @@
+#include "simulation.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <pugixml.hpp>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "failure.hh"
+#include "reliability.hh"
+#include "trace.hh"
+#include "unit.hh"
+#include "util.hh"
+
+namespace oldspot
+{
+
+using namespace pugi;
+using namespace std;
+
+// Default method for finding the next failure
+Simulation::Sampler Simulation::sampler = Simulation::Sampler::UNIT;
+
+// Whether or not to collapse groups that don't depend on the rest of the system
+bool Simulation::collapse = false;
+
+// Number of iterations to run in lockstep when possible
+size_t Simulation::lanes = 1;
+
+// Whether or not to attribute unit failures to failure mechanisms
+bool Simulation::attribution = false;
+
+// Threads for creating units, computing reliability, and running iterations, if any
+ThreadPool* Simulation::pool = nullptr;
+
+// Configuration of an enumerated state whose transitions weren't explored
+static const size_t unexplored = ConfigurationTable::npos - 1;
+
+inline bool
+node_is(const xml_node& node, const string& type)
+{
+    return strcmp(node.attribute("type").value(), type.c_str()) == 0;
+}
+
+/**
+ * Create the Units described by a chip configuration, including replicas of units
+ * with a count.  With a Simulation::pool, units (and so their traces) are loaded in
+ * parallel.
+ */
+vector<shared_ptr<Unit>>
+Simulation::create_units(const xml_document& doc)
+{
+    vector<xml_node> nodes;
+    vector<unsigned int> ids;
+    unsigned int next = 0;
+    for (const xml_node& child: doc.children("unit"))
+    {
+        if (!node_is(child, "unit") && !node_is(child, "core") && !node_is(child, "logic") && !node_is(child, "memory"))
+        {
+            cerr << "unknown unit type \"" << child.attribute("type").value()
+                 << "\" for unit " << child.attribute("name").value() << endl;
+            exit(1);
+        }
+        if (child.attribute("count") && child.attribute("count").as_int() <= 0)
+        {
+            cerr << "unit " << child.attribute("name").value() << " must have a positive count" << endl;
+            exit(1);
+        }
+        nodes.push_back(child);
+        ids.push_back(next);
+        next += child.attribute("count").as_int(1);
+    }
+
+    vector<shared_ptr<Unit>> created(nodes.size());
+    auto create = [&](size_t begin, size_t end, unsigned int){
+        for (size_t i = begin; i < end; i++)
+        {
+            if (node_is(nodes[i], "unit"))
+                created[i] = make_shared<Unit>(nodes[i], ids[i]);
+            else if (node_is(nodes[i], "core"))
+                created[i] = make_shared<Core>(nodes[i], ids[i]);
+            else if (node_is(nodes[i], "logic"))
+                created[i] = make_shared<Logic>(nodes[i], ids[i]);
+            else
+                created[i] = make_shared<Memory>(nodes[i], ids[i]);
+        }
+    };
+    if (pool)
+        pool->run(nodes.size(), 1, create);
+    else
+        create(0, nodes.size(), 0);
+
+    vector<shared_ptr<Unit>> units;
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].attribute("count"))
+        {
+            for (int j = 0; j < nodes[i].attribute("count").as_int(); j++)
+                units.push_back(created[i]->replicate(replica_name(created[i]->name, j), units.size()));
+        }
+        else
+            units.push_back(created[i]);
+    }
+    return units;
+}
+
+/**
+ * Create the units of a system and its failure dependency graph from a chip
+ * configuration, and determine which traces units use in each configuration of
+ * failed units it can reach (exploring up to max_configurations of them).
+ */
+Simulation::Simulation(const xml_document& doc, size_t max_configurations, bool v)
+    : verbose(v), max_states(max_configurations), lockstep(false), squared(false)
+{
+    if (verbose)
+        cout << "Creating units..." << endl;
+    units = create_units(doc);
+    if (verbose)
+    {
+        TraceStatistics stats = traceStatistics();
+        if (stats.segments > 0)
+            cout << "Compressed " << stats.rows << " trace rows into " << stats.segments << " segments ("
+                 << (double)stats.rows/stats.segments << "x)" << endl;
+    }
+    connect(doc);
+}
+
+/**
+ * Create a copy of a system from the chip configuration it was created from, which
+ * can be simulated at the same time as the original.  Its units are replicas of the
+ * original's, so they share traces and reliability functions (including any that
+ * came from streamed rows or overrides) and preparing the copy doesn't compute them
+ * again.  If local is set, the copy gets its own copies of reliability functions the
+ * original already computed, allocated by the calling thread (see Unit::localize).
+ */
+Simulation::Simulation(const Simulation& other, const xml_document& doc, bool local)
+    : verbose(false), max_states(other.max_states), lockstep(false), squared(false)
+{
+    for (const shared_ptr<Unit>& unit: other.units)
+        units.push_back(unit->replicate(unit->name, unit->id));
+    if (local)
+        Unit::localize(units);
+    connect(doc);
+}
+
+/**
+ * Build the failure dependency graph described by a chip configuration over this
+ * Simulation's units and resolve the configurations it can reach.
+ */
+void
+Simulation::connect(const xml_document& doc)
+{
+    if (verbose)
+        cout << "Creating failure dependency graph..." << endl;
+    root = make_shared<Group>(doc.child("group"), units);
+    simulated = units;
+    if (collapse)
+        collapse_static();
+
+    if (verbose)
+        cout << "Resolving configurations..." << endl;
+    configs.reset(new ConfigurationTable(root, simulated, collapsed, max_states));
+}
+
+/**
+ * Collapse the largest groups whose failures can be computed without simulating
+ * the rest of the system (see Group::collapse).  That's the case if each component
+ * in the group appears only once in the failure dependency graph, no unit's traces
+ * depend on whether it has failed, and each unit in it is invariant (see
+ * Unit::invariant), because then the group's members age the same way no matter
+ * what else fails and only the group's own failure is visible to the rest of the
+ * system.  The root can also be collapsed, in which case simulation just samples the
+ * system's lifetime directly.  Groups with only one child aren't worth collapsing.
+ */
+void
+Simulation::collapse_static()
+{
+    unordered_map<shared_ptr<Component>, int> appearances;
+    Component::walk(root, [&](const shared_ptr<Component>& c){
+        for (const shared_ptr<Component>& child: c->children())
+            appearances[child]++;
+    });
+    function<bool(const shared_ptr<Component>&)> independent = [&](const shared_ptr<Component>& c){
+        if (appearances[c] > 1 || any_of(units.begin(), units.end(), [&](const shared_ptr<Unit>& u){ return u->references(c->name); }))
+            return false;
+        if (shared_ptr<Unit> unit = dynamic_pointer_cast<Unit>(c))
+            return unit->invariant();
+        return all_of(c->children().begin(), c->children().end(), independent);
+    };
+
+    unordered_set<shared_ptr<Component>> hidden;
+    Component::conditional_walk(root, [&](const shared_ptr<Component>& c){
+        shared_ptr<Group> group = dynamic_pointer_cast<Group>(c);
+        if (!group)
+            return false;
+        if (appearances[c] > 1 || group->children().size() < 2 || !all_of(c->children().begin(), c->children().end(), independent))
+            return true;
+        Component::walk(c, [&](const shared_ptr<Component>& member){ hidden.insert(member); });
+        group->collapse();
+        collapsed.push_back(group);
+        return false;
+    });
+
+    simulated.clear();
+    for (const shared_ptr<Unit>& unit: units)
+        if (hidden.count(unit) == 0)
+            simulated.push_back(unit);
+    if (verbose)
+        cout << "Collapsed " << collapsed.size() << " groups containing " << units.size() - simulated.size() << " units" << endl;
+}
+
+/**
+ * Find the unit with the given name, or nullptr if there isn't one.
+ */
+shared_ptr<Unit>
+Simulation::unit(const string& name) const
+{
+    for (const shared_ptr<Unit>& u: units)
+        if (u->name == name)
+            return u;
+    return nullptr;
+}
+
+/**
+ * Get the names of the units and collapsed groups that failures in
+ * Simulation::sequences refer to, indexed by failure ID: units by their IDs and then
+ * collapsed groups in order.
+ */
+vector<string>
+Simulation::names() const
+{
+    vector<string> n(units.size());
+    for (const shared_ptr<Unit>& u: units)
+        n[u->id] = u->name;
+    for (const shared_ptr<Group>& group: collapsed)
+        n.push_back(group->name);
+    return n;
+}
+
+/**
+ * Compute the reliability functions of all units for the given failure mechanisms
+ * and group exchangeable units into classes (unless lumping is disabled) so the
+ * system is ready to simulate.  Returns how much work computing reliability took.
+ */
+AggregationStatistics
+Simulation::prepare(const set<shared_ptr<FailureMechanism>>& mechanisms, ReliabilityCache& cache, bool lumping)
+{
+    if (verbose)
+        cout << "Computing aging rates..." << endl;
+    causes.assign(mechanisms.begin(), mechanisms.end());
+    shares.resize(causes.size());
+    vector<AggregationStatistics> computed(units.size());
+    auto compute = [&](size_t begin, size_t end, unsigned int){
+        for (size_t i = begin; i < end; i++)
+            computed[i] = units[i]->compute_reliability(mechanisms, cache);
+    };
+    if (pool)
+        pool->run(units.size(), 1, compute);
+    else
+        compute(0, units.size(), 0);
+    AggregationStatistics aggregation;
+    for (const AggregationStatistics& stats: computed)
+    {
+        aggregation.segments += stats.segments;
+        aggregation.evaluations += stats.evaluations;
+        aggregation.error = max(aggregation.error, stats.error);
+    }
+    if (lumping)
+        classes = UnitClass::lump(root, simulated);
+    else
+        classes.assign(simulated.begin(), simulated.end());
+    if (verbose)
+        cout << "Simulating " << simulated.size() << " units as " << classes.size() << " classes" << endl;
+
+    tables.clear();
+    for (const shared_ptr<Group>& group: collapsed)
+        tables.emplace_back([&](double t){ return group->cumulative_hazard(t); });
+
+    parameters.assign(configs->size(), Parameters());
+    unlisted.clear();
+    healthy.resize(classes.size());
+    ages.resize(classes.size());
+    reliabilities.resize(classes.size());
+    chains.assign(classes.size(), vector<double>());
+    enumerate();
+    return aggregation;
+}
+
+/**
+ * Enumerate the states the system can reach before it fails, starting from a fresh
+ * system, where a state is the number of healthy members of each class and which
+ * collapsed groups have failed.  Members of a class are exchangeable, so it doesn't
+ * matter which of them have failed.  For each state, find its configuration and, for
+ * each class or group that can fail, the state that failure leads to (accounting for
+ * units that fail because their parents do) and the groups that fail as a result.
+ * States are explored breadth-first until max_states have been found, except for
+ * ones whose configurations aren't in the ConfigurationTable.
+ */
+void
+Simulation::enumerate()
+{
+    size_t n = classes.size() + collapsed.size();
+    vector<shared_ptr<Group>> groups;
+    Component::walk(root, [&](const shared_ptr<Component>& c){
+        shared_ptr<Group> group = dynamic_pointer_cast<Group>(c);
+        if (group && find(collapsed.begin(), collapsed.end(), group) == collapsed.end())
+            groups.push_back(group);
+    });
+
+    auto load = [&](const vector<uint32_t>& state){
+        for (size_t i = 0; i < classes.size(); i++)
+            classes[i].restore(state[i]);
+        for (size_t i = 0; i < collapsed.size(); i++)
+        {
+            if (state[classes.size() + i] > 0)
+                collapsed[i]->reset();
+            else
+                collapsed[i]->failure();
+        }
+    };
+
+    counts.clear();
+    transitions.clear();
+    offsets.assign(1, 0);
+    recorded.clear();
+    configurations.clear();
+    map<vector<uint32_t>, size_t> ids;
+    vector<vector<uint32_t>> states;
+    auto add = [&](const vector<uint32_t>& state){
+        auto entry = ids.find(state);
+        if (entry != ids.end())
+            return entry->second;
+        if (states.size() >= max_states)
+            return ConfigurationTable::npos;
+        ids[state] = states.size();
+        states.push_back(state);
+        return states.size() - 1;
+    };
+
+    vector<uint32_t> fresh(n, 1);
+    for (size_t i = 0; i < classes.size(); i++)
+        fresh[i] = classes[i].size();
+    add(fresh);
+    for (size_t s = 0; s < states.size(); s++)
+    {
+        vector<uint32_t> state = states[s];
+        counts.insert(counts.end(), state.begin(), state.end());
+        load(state);
+        size_t id = ConfigurationTable::npos;
+        if (!root->failed())
+        {
+            // A configuration that isn't in the table is resolved during simulation
+            // instead, so the state's transitions aren't explored
+            Unit::config_t config = Unit::configuration(root);
+            id = configs->id(config);
+            if (id == ConfigurationTable::npos)
+                id = unexplored;
+            else
+                configure(config, id);
+        }
+        configurations.push_back(id);
+
+        vector<bool> failed(groups.size());
+        for (size_t g = 0; g < groups.size(); g++)
+            failed[g] = groups[g]->failed();
+        for (size_t i = 0; i < n; i++)
+        {
+            if (id == ConfigurationTable::npos || id == unexplored || state[i] == 0)
+            {
+                transitions.push_back(ConfigurationTable::npos);
+                offsets.push_back(recorded.size());
+                continue;
+            }
+
+            load(state);
+            if (i < classes.size())
+                classes[i].restore(state[i] - 1);
+            else
+                collapsed[i - classes.size()]->failure();
+            Unit::parents_failed(root, simulated);
+            Group::parents_failed(root, collapsed);
+
+            vector<uint32_t> next(n);
+            for (size_t j = 0; j < classes.size(); j++)
+                next[j] = classes[j].surviving();
+            for (size_t j = 0; j < collapsed.size(); j++)
+                next[classes.size() + j] = !collapsed[j]->failed();
+            if (i >= classes.size())
+                recorded.push_back(collapsed[i - classes.size()].get());
+            for (size_t g = 0; g < groups.size(); g++)
+                if (!failed[g] && groups[g]->failed())
+                    recorded.push_back(groups[g].get());
+            transitions.push_back(add(next));
+            offsets.push_back(recorded.size());
+        }
+    }
+
+    for (UnitClass& c: classes)
+        c.reset();
+    for (const shared_ptr<Group>& group: collapsed)
+        group->reset();
+    if (verbose)
+        cout << "Enumerated " << configurations.size() << " states" << endl;
+
+    lockstep = !configurations.empty() && configurations[0] != ConfigurationTable::npos;
+    squared = true;
+    for (size_t s = 0; s < configurations.size() && lockstep; s++)
+    {
+        if (configurations[s] == ConfigurationTable::npos)
+            continue;
+        lockstep = configurations[s] != unexplored && !parameters[configurations[s]].scheduled;
+        for (size_t i = 0; i < n && lockstep; i++)
+            lockstep = counts[s*n + i] == 0 || transitions[s*n + i] != ConfigurationTable::npos;
+        for (size_t i = 0; i < classes.size() && lockstep; i++)
+            squared = squared && parameters[configurations[s]].betas[i] == 2;
+    }
+}
+
+/**
+ * Get the Weibull parameters of each class of units when the system is in
+ * configuration config, whose index in the ConfigurationTable is id.  Parameters for
+ * configurations in the table are only looked up the first time they are reached;
+ * others are looked up into scratch.
+ */
+const Simulation::Parameters&
+Simulation::configure(const Unit::config_t& config, size_t id, Parameters* scratch)
+{
+    bool listed = id < parameters.size();
+    Parameters& p = listed ? parameters[id] : *scratch;
+    if (p.alphas.empty() || !listed)
+    {
+        p.alphas.resize(classes.size());
+        p.betas.resize(classes.size());
+        p.schedules.resize(classes.size());
+        p.scheduled = false;
+        for (size_t i = 0; i < classes.size(); i++)
+        {
+            const WeibullDistribution& distribution = classes[i].representative()->distribution(config, id);
+            p.alphas[i] = distribution.rate();
+            p.betas[i] = distribution.shape();
+            p.schedules[i] = classes[i].representative()->schedule(config, id);
+            p.scheduled = p.scheduled || p.schedules[i];
+        }
+        p.mechanisms.clear();
+        for (size_t i = 0; i < classes.size() && attribution; i++)
+            for (const shared_ptr<FailureMechanism>& mechanism: causes)
+                p.mechanisms.push_back(classes[i].representative()->distribution(config, id, mechanism));
+    }
+    return p;
+}
+
+/**
+ * Find what's known about the current set of failed units and collapsed groups
+ * outside the enumerated states, adding it to the cache if it's new and there's room.
+ * Otherwise, it uses whichever spare doesn't hold the parameters previous, which are
+ * still needed.
+ */
+Simulation::Unlisted&
+Simulation::lookup(const Parameters* previous)
+{
+    key.resize(simulated.size() + collapsed.size());
+    for (size_t i = 0; i < simulated.size(); i++)
+        key[i] = simulated[i]->failed();
+    for (size_t i = 0; i < collapsed.size(); i++)
+        key[simulated.size() + i] = collapsed[i]->failed();
+    auto entry = unlisted.find(key);
+    if (entry != unlisted.end())
+        return entry->second;
+    if (unlisted.size() < max_states)
+        return unlisted[key];
+    Unlisted& u = spare[previous == &spare[0].parameters];
+    u.resolved = u.walked = false;
+    return u;
+}
+
+/**
+ * Find whether the system has failed with the current set of failures outside the
+ * enumerated states and, if not, the parameters of its configuration, walking the
+ * failure dependency graph only the first time the set is reached.
+ */
+Simulation::Unlisted&
+Simulation::resolve(const Parameters* previous)
+{
+    Unlisted& u = lookup(previous);
+    if (!u.resolved)
+    {
+        u.down = root->failed();
+        if (!u.down)
+        {
+            Unit::config_t config = Unit::configuration(root);
+            u.p = &configure(config, configs->id(config), &u.parameters);
+        }
+        u.resolved = true;
+    }
+    return u;
+}
+
+/**
+ * Find which components have failed right after an event outside the enumerated
+ * states and fail the units and collapsed groups whose parents have, walking the
+ * failure dependency graph only the first time the set of failures is reached.
+ */
+Simulation::Unlisted&
+Simulation::walk(const Parameters* previous)
+{
+    Unlisted& u = lookup(previous);
+    if (!u.walked)
+    {
+        u.failed.clear();
+        Component::walk(root, [&](const shared_ptr<Component>& c){
+            if (c->failed())
+                u.failed.push_back(c);
+        });
+        u.orphans = Unit::parents_failed(root, simulated);
+        u.orphaned = Group::parents_failed(root, collapsed);
+        u.walked = true;
+        return u;
+    }
+    for (const shared_ptr<Unit>& unit: u.orphans)
+        unit->abandon();
+    for (const shared_ptr<Group>& group: u.orphaned)
+        group->failure();
+    return u;
+}
+
+/**
+ * Update the age and reliability of each healthy class of units after dt time has
+ * passed since time t in the configuration with parameters p (classes with
+ * AgingSchedules age by however much their schedules say they do over that time
+ * instead of by dt).  If the previous configuration's
+ * parameters were different, ages are first shifted so that each class keeps the
+ * reliability it had at the end of the previous configuration, according to:
+ * [1] Bolchini, C., Carminati, M., Gribaudo, M., and Miele, A. A lightweight and
+ *     open-source framework for the lifetime estimation of multicore systems. ICCD 2014.
+ */
+void
+Simulation::advance(const Parameters* previous, const Parameters& p, double t, double dt)
+{
+    const double* alphas = p.alphas.data();
+    const double* betas = p.betas.data();
+    for (size_t i = 0; i < classes.size(); i++)
+    {
+        if (healthy[i] == 0)
+            continue;
+        ages[i] += p.scheduled && p.schedules[i] ? p.schedules[i]->age(t + dt) - p.schedules[i]->age(t) : dt;
+        if (previous && (previous->alphas[i] != alphas[i] || previous->betas[i] != betas[i]))
+            ages[i] -= WeibullDistribution(previous->alphas[i], previous->betas[i]).inverse(reliabilities[i])
+                     - WeibullDistribution(alphas[i], betas[i]).inverse(reliabilities[i]);
+        reliabilities[i] = exp(-pow(ages[i]/alphas[i], betas[i]));
+    }
+}
+
+/**
+ * Find the next failure by sampling the time of the next failure in each class of
+ * units and taking the earliest.  A class with m healthy members and reliability R
+ * fails next when their reliability reaches R*u^(1/m), where u is uniform in (0, 1],
+ * and a collapsed group that has survived until time t into the iteration fails when
+ * its cumulative hazard has increased from H(t) by an exponentially-distributed amount.
+ *
+ * Swapping in a serial spare doesn't change the configuration, so a unit with spares
+ * fails for good after its current copy and then each of its spares fail in turn
+ * (unless another failure changes the configuration first), and its whole chain of
+ * copies is sampled at once rather than one event per copy.  Sampling stops once the
+ * chain passes the earliest failure found so far, since later copies can't matter.
+ *
+ * Classes with AgingSchedules sample their failures in terms of age, which are then
+ * converted to times.
+ *
+ * Returns the time until the next failure and sets failed to the class it happens in
+ * or, if it's a collapsed group, to the number of classes plus the group's index.
+ */
+double
+Simulation::next_event(const Parameters& p, double t, mt19937& gen, size_t& failed)
+{
+    uniform_real_distribution<double> u(0, 1);
+    double dt_event = numeric_limits<double>::infinity();
+    for (size_t i = 0; i < classes.size(); i++)
+    {
+        chains[i].clear();
+        if (healthy[i] == 0)
+            continue;
+        WeibullDistribution distribution(p.alphas[i], p.betas[i]);
+        double next = distribution.inverse(reliabilities[i]*pow(u(gen), 1.0/healthy[i]));
+        if (isinf(next))
+            continue;
+        double da = next - distribution.inverse(reliabilities[i]);
+        const AgingSchedule* schedule = p.scheduled ? p.schedules[i] : nullptr;
+        double now = schedule ? schedule->age(t) : 0;
+        auto elapsed = [&](double a){ return schedule ? schedule->time(now + a) - t : a; };
+        double dt = elapsed(da);
+
+        int spares = classes[i].representative()->spares();
+        if (spares > 0)
+        {
+            chains[i].push_back(dt);
+            for (int j = 0; j < spares && dt < dt_event; j++)
+                chains[i].push_back(dt = elapsed(da += distribution.inverse(1 - u(gen))));
+            if (chains[i].size() <= (size_t)spares)
+                continue;
+        }
+        if (dt_event > dt)
+        {
+            failed = i;
+            dt_event = dt;
+        }
+    }
+
+    // Collapsed groups have aged for the whole iteration so far
+    exponential_distribution<double> e(1);
+    for (size_t i = 0; i < collapsed.size(); i++)
+    {
+        if (collapsed[i]->failed())
+            continue;
+        double dt = tables[i].inverse_hazard(tables[i].hazard(t) + e(gen)) - t;
+        if (dt_event > dt)
+        {
+            failed = classes.size() + i;
+            dt_event = dt;
+        }
+    }
+    return dt_event;
+}
+
+/**
+ * Find the next failure by treating the healthy units as competing risks.  The time
+ * until the first failure is where the sum of their cumulative hazards since now
+ * reaches an exponentially-distributed value, and the class it happens in is chosen
+ * with probability proportional to its hazard at that time.  With a Weibull reliability
+ * R(t) = exp(-(t/a)^b) and effective age t0 (see Simulation::advance), the m healthy
+ * members of a class contribute a cumulative hazard of m*(((t0 + dt)/a)^b - (t0/a)^b),
+ * which is a quadratic in dt when b = 2 (as it is for all current aging mechanisms) and
+ * is otherwise solved numerically, as it is when there are collapsed groups, which
+ * contribute H(t + dt) - H(t) from their tables, or when classes have AgingSchedules,
+ * in which case dt is replaced by how much they age over it.  This takes one draw for the time
+ * instead of one per class.  Returns the time until the failure and sets failed as in
+ * Simulation::next_event.
+ */
+double
+Simulation::competing_event(const Parameters& p, double t, mt19937& gen, size_t& failed)
+{
+    const double* alphas = p.alphas.data();
+    const double* betas = p.betas.data();
+    auto at_risk = [&](size_t i){
+        return i < classes.size() ? healthy[i] > 0 && !isinf(alphas[i]) : !collapsed[i - classes.size()]->failed();
+    };
+    auto age = [&](size_t i){ return WeibullDistribution(alphas[i], betas[i]).inverse(reliabilities[i]); };
+    auto aged = [&](size_t i, double x){
+        return p.scheduled && p.schedules[i] ? p.schedules[i]->age(t + x) - p.schedules[i]->age(t) : x;
+    };
+    auto pace = [&](size_t i, double x){ return p.scheduled && p.schedules[i] ? p.schedules[i]->rate(t + x) : 1; };
+    size_t n = classes.size() + collapsed.size();
+
+    bool quadratic = true, any = false;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!at_risk(i))
+            continue;
+        quadratic = quadratic && i < classes.size() && betas[i] == 2 && !(p.scheduled && p.schedules[i]);
+        any = true;
+    }
+    if (!any)
+        return numeric_limits<double>::infinity();
+
+    double target = exponential_distribution<double>(1)(gen);
+    double dt;
+    if (quadratic)
+    {
+        // sum(m*((t0 + dt)^2 - t0^2)/a^2) = A*dt^2 + B*dt
+        double A = 0, B = 0;
+        for (size_t i = 0; i < classes.size(); i++)
+        {
+            if (!at_risk(i))
+                continue;
+            double w = healthy[i]/(alphas[i]*alphas[i]);
+            A += w;
+            B += 2*w*age(i);
+        }
+        dt = 2*target/(B + sqrt(B*B + 4*A*target)); // Avoids cancellation when B >> A*dt
+    }
+    else
+    {
+        auto hazard = [&](double x) {
+            double H = 0, h = 0;
+            for (size_t i = 0; i < classes.size(); i++)
+            {
+                if (!at_risk(i))
+                    continue;
+                double t0 = age(i), a = aged(i, x);
+                H += healthy[i]*(pow((t0 + a)/alphas[i], betas[i]) - pow(t0/alphas[i], betas[i]));
+                h += healthy[i]*betas[i]/alphas[i]*pow((t0 + a)/alphas[i], betas[i] - 1)*pace(i, x);
+            }
+            for (size_t i = 0; i < collapsed.size(); i++)
+            {
+                if (!at_risk(classes.size() + i))
+                    continue;
+                H += tables[i].hazard(t + x) - tables[i].hazard(t);
+                h += tables[i].hazard_rate(t + x);
+            }
+            return make_pair(H, h);
+        };
+
+        // Bracket the solution, starting from the earliest time any one risk alone
+        // would reach it, and then refine it with Newton steps that fall back to
+        // bisection when they leave the bracket
+        double lo = 0, hi = numeric_limits<double>::infinity();
+        for (size_t i = 0; i < classes.size(); i++)
+            if (at_risk(i))
+                hi = min(hi, alphas[i]);
+        for (size_t i = 0; i < collapsed.size(); i++)
+            if (at_risk(classes.size() + i))
+                hi = min(hi, tables[i].inverse_hazard(tables[i].hazard(t) + target) - t);
+        if (isinf(hi))
+            return hi;
+        while (hazard(hi).first < target)
+            hi *= 2;
+        dt = hi;
+        for (int i = 0; i < 100 && hi - lo > 1e-12*hi; i++)
+        {
+            pair<double, double> H = hazard(dt);
+            if (H.first < target)
+                lo = dt;
+            else
+                hi = dt;
+            double next = dt - (H.first - target)/H.second;
+            dt = next > lo && next < hi ? next : (lo + hi)/2;
+        }
+    }
+
+    double total = 0;
+    hazards.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (at_risk(i) && i < classes.size())
+            total += healthy[i]*betas[i]/alphas[i]*pow((age(i) + aged(i, dt))/alphas[i], betas[i] - 1)*pace(i, dt);
+        else if (at_risk(i))
+            total += tables[i - classes.size()].hazard_rate(t + dt);
+        hazards[i] = total;
+    }
+    double u = uniform_real_distribution<double>(0, total)(gen);
+    failed = upper_bound(hazards.begin(), hazards.end(), u) - hazards.begin();
+    while (failed >= n || !at_risk(failed)) // Guard against u == total
+        failed = failed >= n ? n - 1 : failed - 1;
+    return dt;
+}
+
+/**
+ * Fail the copies of units in chains of serial spares (see next_event) that failed
+ * during the dt time since the last event at time t, and set the ages and
+ * reliabilities of the spares that replaced them in the configuration with
+ * parameters p.
+ */
+void
+Simulation::spend(const Parameters& p, double t, double dt, mt19937& gen)
+{
+    for (size_t i = 0; i < classes.size(); i++)
+    {
+        const vector<double>& chain = chains[i];
+        size_t spent = lower_bound(chain.begin(), chain.end(), dt) - chain.begin();
+        if (spent == 0)
+            continue;
+        for (size_t j = 0; j < spent; j++)
+            classes[i].failure(gen);
+        if (p.scheduled && p.schedules[i])
+            ages[i] = p.schedules[i]->age(t + dt) - p.schedules[i]->age(t + chain[spent - 1]);
+        else
+            ages[i] = dt - chain[spent - 1];
+        reliabilities[i] = exp(-pow(ages[i]/p.alphas[i], p.betas[i]));
+    }
+}
+
+/**
+ * Attribute the failure at time t of the member of class i that just failed in the
+ * configuration with parameters p to a failure mechanism.  Since the unit's
+ * reliability is the product of its mechanisms', they are competing risks, and the
+ * mechanism is chosen in proportion to its hazard at the class's age.
+ */
+void
+Simulation::attribute(const Parameters& p, size_t i, double t, mt19937& gen)
+{
+    size_t k = causes.size();
+    double total = 0;
+    for (size_t m = 0; m < k; m++)
+    {
+        total += p.mechanisms[i*k + m].hazard(ages[i]);
+        shares[m] = total;
+    }
+    size_t m = 0;
+    if (total > 0 && isfinite(total))
+    {
+        double u = uniform_real_distribution<double>(0, total)(gen);
+        m = min<size_t>(upper_bound(shares.begin(), shares.end(), u) - shares.begin(), k - 1);
+    }
+    classes[i].member(classes[i].healthy())->attribute(m, t);
+}
+
+/**
+ * Perform Monte Carlo iterations to find the failure distribution of the system,
+ * recording the time at which each component fails in each iteration.
+ * While the system is in an enumerated state (see Simulation::enumerate), failures
+ * are looked up in the state tables; once it leaves them, the failure dependency
+ * graph is walked after each failure to find what failed.
+ */
+void
+Simulation::run(int iterations, mt19937& gen)
+{
+    if (lanes > 1 && lockstep && sampler == Sampler::UNIT && !attribution && !FailureSequences::enabled())
+    {
+        run_lanes(iterations, gen);
+        return;
+    }
+    if (lanes > 1 && verbose)
+        cout << "Running iterations one at a time (lockstep needs enumerated states, uniform aging, unit sampling, and no failure attribution or sequences)" << endl;
+
+    const size_t npos = ConfigurationTable::npos;
+    size_t n = classes.size() + collapsed.size();
+    for (int i = 0; i < iterations; i++)
+    {
+        if (verbose)
+            cout << "Beginning Monte Carlo iteration " << i << endl;
+
+        unordered_set<shared_ptr<Component>> failed_components;
+        auto find_failed = [&]{
+            Component::walk(root, [&](const shared_ptr<Component>& c){
+                if (c->failed())
+                    failed_components.insert(c);
+            });
+        };
+
+        double t = 0;
+        sequence.clear();
+        for (size_t j = 0; j < classes.size(); j++)
+        {
+            classes[j].reset();
+            healthy[j] = classes[j].healthy();
+            ages[j] = 0;
+            reliabilities[j] = 1;
+        }
+        for (const shared_ptr<Group>& group: collapsed)
+            group->reset();
+        size_t state = configurations.empty() ? npos : 0;
+        const Parameters* previous = nullptr;
+        while (true)
+        {
+            if (state != npos && configurations[state] == unexplored)
+            {
+                find_failed();
+                state = npos;
+            }
+            const Parameters* p;
+            if (state != npos)
+            {
+                if (configurations[state] == npos)
+                    break;
+                p = &parameters[configurations[state]];
+            }
+            else
+            {
+                Unlisted& u = resolve(previous);
+                if (u.down)
+                    break;
+                p = u.p;
+            }
+
+            size_t failed = n;
+            double dt_event = sampler == Sampler::COMPETING ? competing_event(*p, t, gen, failed) : next_event(*p, t, gen, failed);
+            if (isinf(dt_event))
+            {
+                WARN("no unit failure during iteration %d\n", i);
+                break;
+            }
+
+            advance(previous, *p, t, dt_event);
+            previous = p;
+            spend(*p, t, dt_event, gen);
+            size_t next = state != npos ? transitions[state*n + failed] : npos;
+            if (state != npos && next == npos)
+            {
+                // Leaving the enumerated states, so continue by walking the graph
+                find_failed();
+                state = npos;
+            }
+            bool changed = true;
+            if (failed >= classes.size())
+                collapsed[failed - classes.size()]->failure();
+            else
+            {
+                if (classes[failed].failure(gen))
+                {
+                    ages[failed] = 0;
+                    reliabilities[failed] = 1;
+                }
+                changed = classes[failed].healthy() < healthy[failed];
+            }
+            t += dt_event;
+            if (attribution && changed && failed < classes.size())
+                attribute(*p, failed, t, gen);
+            if (FailureSequences::enabled() && changed)
+                sequence.push_back(failed < classes.size() ? classes[failed].member(classes[failed].healthy())->id
+                                                           : units.size() + failed - classes.size());
+
+            if (state != npos)
+            {
+                if (!changed)
+                    continue;
+                if (failed < classes.size())
+                    classes[failed].member(classes[failed].healthy())->record(t);
+                for (size_t j = offsets[state*n + failed]; j < offsets[state*n + failed + 1]; j++)
+                    recorded[j]->record(t);
+                const uint32_t* c = &counts[next*n];
+                for (size_t j = 0; j < classes.size(); j++)
+                {
+                    if (classes[j].healthy() > c[j])
+                        classes[j].abandon();
+                    healthy[j] = c[j];
+                }
+                for (size_t j = 0; j < collapsed.size(); j++)
+                    if (c[classes.size() + j] == 0)
+                        collapsed[j]->failure();
+                state = next;
+                continue;
+            }
+
+            Unlisted& u = walk(p);
+            for (const shared_ptr<Component>& c: u.failed)
+                if (failed_components.insert(c).second)
+                    c->record(t);
+            failed_components.insert(u.orphans.begin(), u.orphans.end());
+            failed_components.insert(u.orphaned.begin(), u.orphaned.end());
+            for (size_t j = 0; j < classes.size(); j++)
+            {
+                classes[j].update();
+                healthy[j] = classes[j].healthy();
+            }
+        }
+        if (FailureSequences::enabled())
+            sequences.count(sequence, t);
+    }
+}
+
+/**
+ * Perform Monte Carlo iterations like Simulation::run, but run Simulation::lanes of
+ * them at a time in lockstep, each in its own lane, which is only possible when every
+ * iteration stays within the enumerated states, all classes age uniformly, and
+ * failures are sampled for each unit.  Each step samples the next failure in every
+ * lane and then advances every lane to its failure, and the state of each class
+ * (its Weibull parameters, number of healthy members, and cumulative hazard) is
+ * stored by class and then by lane so that both are loops over contiguous arrays
+ * that the compiler can vectorize.  When a lane's system fails, the lane starts the
+ * next iteration until there are none left, so lanes stay full until the end.
+ *
+ * Classes track their cumulative hazards H rather than their ages, which keeps their
+ * reliabilities when the configuration changes without shifting ages (see
+ * Simulation::advance).  The next failure in a class with m healthy members is where
+ * H has increased by an exponentially-distributed amount divided by m, and aging by dt
+ * takes H to (H^(1/b) + dt/a)^b, which is just a square root and a square when b is 2.
+ * Members that fail are tracked in each lane by their own order of each class's
+ * members rather than by the UnitClass, so each one is still recorded.
+ */
+void
+Simulation::run_lanes(int iterations, mt19937& gen)
+{
+    const size_t npos = ConfigurationTable::npos;
+    const double inf = numeric_limits<double>::infinity();
+    const bool square = squared;
+    size_t W = lanes;
+    size_t n = classes.size() + collapsed.size();
+    vector<size_t> first(classes.size() + 1, 0);
+    for (size_t j = 0; j < classes.size(); j++)
+        first[j + 1] = first[j] + classes[j].size();
+    size_t M = first.back();
+
+    // State of each lane, and of each class in each lane (indexed by class*W + lane),
+    // and the order of each lane's members (indexed by lane*M + first[class]), in
+    // which the healthy ones come first
+    vector<size_t> state(W, npos);
+    vector<int> iteration(W, -1);
+    vector<double> t(W, 0), dt(W), draws(W);
+    vector<size_t> failed(W);
+    vector<double> alphas(classes.size()*W), betas(classes.size()*W), members(classes.size()*W, 0);
+    vector<double> cumulative(classes.size()*W, 0);
+    vector<int> remaining(classes.size()*W);
+    vector<uint32_t> order(W*M);
+
+    auto enter = [&](size_t l, size_t s){
+        const Parameters& p = parameters[configurations[s]];
+        state[l] = s;
+        for (size_t j = 0; j < classes.size(); j++)
+        {
+            alphas[j*W + l] = p.alphas[j];
+            betas[j*W + l] = p.betas[j];
+            members[j*W + l] = counts[s*n + j];
+        }
+    };
+    int started = 0;
+    auto start = [&](size_t l){
+        if (started == iterations)
+        {
+            state[l] = npos;
+            for (size_t j = 0; j < classes.size(); j++)
+                members[j*W + l] = 0;
+            return false;
+        }
+        if (verbose)
+            cout << "Beginning Monte Carlo iteration " << started << endl;
+        iteration[l] = started++;
+        t[l] = 0;
+        for (size_t j = 0; j < classes.size(); j++)
+        {
+            cumulative[j*W + l] = 0;
+            remaining[j*W + l] = classes[j].copies();
+            for (size_t k = 0; k < classes[j].size(); k++)
+                order[l*M + first[j] + k] = k;
+        }
+        enter(l, 0);
+        return true;
+    };
+
+    size_t running = 0;
+    for (size_t l = 0; l < W; l++)
+        running += start(l);
+    exponential_distribution<double> e(1);
+    while (running > 0)
+    {
+        fill(dt.begin(), dt.end(), inf);
+        fill(failed.begin(), failed.end(), n);
+        for (size_t j = 0; j < classes.size(); j++)
+        {
+            const double* a = &alphas[j*W];
+            const double* b = &betas[j*W];
+            const double* m = &members[j*W];
+            const double* H = &cumulative[j*W];
+            // Increases in H, which then become times until failure
+            for (size_t l = 0; l < W; l++)
+                draws[l] = m[l] > 0 ? e(gen) : 0;
+            if (square)
+                for (size_t l = 0; l < W; l++)
+                    draws[l] = a[l]*(sqrt(H[l] + draws[l]/m[l]) - sqrt(H[l]));
+            else
+                for (size_t l = 0; l < W; l++)
+                    draws[l] = a[l]*(pow(H[l] + draws[l]/m[l], 1/b[l]) - pow(H[l], 1/b[l]));
+            for (size_t l = 0; l < W; l++)
+            {
+                double next = m[l] > 0 ? draws[l] : inf;
+                failed[l] = next < dt[l] ? j : failed[l];
+                dt[l] = min(dt[l], next);
+            }
+        }
+        for (size_t j = 0; j < collapsed.size(); j++)
+        {
+            for (size_t l = 0; l < W; l++)
+            {
+                if (state[l] == npos || counts[state[l]*n + classes.size() + j] == 0)
+                    continue;
+                double next = tables[j].inverse_hazard(tables[j].hazard(t[l]) + e(gen)) - t[l];
+                if (next < dt[l])
+                {
+                    dt[l] = next;
+                    failed[l] = classes.size() + j;
+                }
+            }
+        }
+
+        for (size_t j = 0; j < classes.size(); j++)
+        {
+            const double* a = &alphas[j*W];
+            const double* b = &betas[j*W];
+            double* H = &cumulative[j*W];
+            if (square)
+            {
+                for (size_t l = 0; l < W; l++)
+                {
+                    double x = sqrt(H[l]) + dt[l]/a[l];
+                    H[l] = x*x;
+                }
+            }
+            else
+                for (size_t l = 0; l < W; l++)
+                    H[l] = pow(pow(H[l], 1/b[l]) + dt[l]/a[l], b[l]);
+        }
+
+        for (size_t l = 0; l < W; l++)
+        {
+            if (state[l] == npos)
+                continue;
+            if (isinf(dt[l]))
+            {
+                WARN("no unit failure during iteration %d\n", iteration[l]);
+                running -= !start(l);
+                continue;
+            }
+            t[l] += dt[l];
+            size_t j = failed[l];
+            if (j < classes.size())
+            {
+                size_t i = j*W + l;
+                if (--remaining[i] > 0)
+                {
+                    // Spare swapped in or parallel copy lost without the unit failing
+                    if (classes[j].serial())
+                        cumulative[i] = 0;
+                    continue;
+                }
+                remaining[i] = classes[j].copies();
+                size_t m = members[i];
+                uint32_t* slots = &order[l*M + first[j]];
+                swap(slots[m > 1 ? uniform_int_distribution<size_t>(0, m - 1)(gen) : 0], slots[m - 1]);
+                classes[j].member(slots[m - 1])->record(t[l]);
+            }
+            size_t s = state[l];
+            for (size_t k = offsets[s*n + j]; k < offsets[s*n + j + 1]; k++)
+                recorded[k]->record(t[l]);
+            size_t next = transitions[s*n + j];
+            if (configurations[next] == npos)
+                running -= !start(l);
+            else
+                enter(l, next);
+        }
+    }
+}
+
+/**
+ * Perform Monte Carlo iterations like Simulation::run, but in chunks of the given
+ * number of iterations that are spread over the threads of Simulation::pool.  Each
+ * thread simulates its chunks with its own copy of this system (see
+ * Simulation::Simulation) from copies, which must have one for each thread.  Then the
+ * first thread on each NUMA node adds what the copies on its node recorded to its own
+ * copy, and those are added to this system's components.  Each chunk's random numbers
+ * come from its own generator, seeded from gen in order.
+ */
+void
+Simulation::run(int iterations, mt19937& gen, const vector<unique_ptr<Simulation>>& copies, size_t chunk)
+{
+    chunk = max<size_t>(chunk, 1);
+    vector<mt19937::result_type> seeds((iterations + chunk - 1)/chunk);
+    for (mt19937::result_type& seed: seeds)
+        seed = gen();
+    pool->run(iterations, chunk, [&](size_t begin, size_t end, unsigned int w){
+        mt19937 chunk_gen(seeds[begin/chunk]);
+        copies[w]->run(end - begin, chunk_gen);
+    });
+    pool->each([&](unsigned int w){
+        if (pool->lead(w) != w)
+            return;
+        for (unsigned int v = w + 1; v < copies.size(); v++)
+        {
+            if (pool->lead(v) == w)
+            {
+                copies[w]->merge(*copies[v]);
+                copies[v]->clear();
+            }
+        }
+    });
+    for (unsigned int w = 0; w < copies.size(); w++)
+    {
+        if (pool->lead(w) == w)
+        {
+            merge(*copies[w]);
+            copies[w]->clear();
+        }
+    }
+}
+
+/**
+ * Add the times to failure and failure sequences recorded by another copy of this
+ * system (see Simulation::Simulation) to this one's.
+ */
+void
+Simulation::merge(const Simulation& other)
+{
+    sequences.merge(other.sequences);
+    vector<shared_ptr<Component>> mine(units.begin(), units.end()), theirs(other.units.begin(), other.units.end());
+    Component::walk(root, [&](const shared_ptr<Component>& c){ mine.push_back(c); });
+    Component::walk(other.root, [&](const shared_ptr<Component>& c){ theirs.push_back(c); });
+    unordered_set<Component*> merged; // Components can appear in the graph more than once
+    for (size_t i = 0; i < mine.size() && i < theirs.size(); i++)
+        if (merged.insert(mine[i].get()).second)
+            mine[i]->merge(*theirs[i]);
+}
+
+/**
+ * Forget the times to failure and failure sequences recorded by previous calls to
+ * run.
+ */
+void
+Simulation::clear()
+{
+    Component::walk(root, [](const shared_ptr<Component>& c){ c->clear(); });
+    sequences.clear();
+}
+
+} // namespace oldspot
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <pugixml.hpp>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "failure.hh"
+#include "pool.hh"
+#include "reliability.hh"
+#include "sequences.hh"
+#include "unit.hh"
+
+namespace oldspot
+{
+
+/**
+ * A system described by a chip configuration that can be simulated to find its
+ * failure distribution.  Units track their own failures and the Simulation tracks
+ * their aging during a Monte Carlo iteration, so simulations that run at the same
+ * time each need their own Simulation, but Simulations of the same system share
+ * traces through the trace store and can share reliability functions through a
+ * ReliabilityCache.
+ *
+ * Aging is tracked for each class of exchangeable units (see UnitClass) in arrays
+ * indexed by class, and the Weibull parameters of every class are looked up once per
+ * configuration rather than once per unit per event, so advancing the system to its
+ * next failure is a few passes over contiguous arrays.
+ *
+ * Before simulating, the states the system can reach are enumerated (up to the same
+ * limit as configurations) along with the state each failure leads to, so that most
+ * events are handled by indexing into tables rather than by walking the failure
+ * dependency graph.  Iterations that leave the enumerated states finish by walking it.
+ *
+ * When every state the system can reach has been enumerated, Simulation::lanes
+ * iterations can be run in lockstep (see Simulation::run_lanes), which is faster for
+ * small systems whose iterations each take only a few events.
+ *
+ * With a Simulation::pool, units are created and their reliability is computed in
+ * parallel, and iterations can be spread over copies of the system that share their
+ * units' reliability functions, one for each worker (see Simulation::run).  Copies can
+ * instead have their own reliability functions, so that workers on each NUMA node can
+ * share a copy in their node's memory.
+ *
+ * With Simulation::attribution, each unit failure is attributed to one of the
+ * failure mechanisms as a competing risk (see Simulation::attribute), and units
+ * count how many of their failures each mechanism caused.
+ *
+ * With FailureSequences enabled, the order in which units fail in each iteration is
+ * counted in Simulation::sequences.
+ *
+ * Optionally, groups whose units don't depend on the rest of the system are collapsed
+ * into single pseudo-units whose reliability is computed from their members' and
+ * tabulated before simulating.  Units inside them don't get times to failure.
+ */
+class Simulation
+{
+  public:
+    /**
+     * Method for finding the next failure in a Monte Carlo iteration: either sample
+     * the next failure of each class of units and take the earliest or sample the
+     * next failure of the system as a whole from the units' competing risks.
+     */
+    enum class Sampler { UNIT, COMPETING };
+
+  private:
+    /**
+     * Weibull parameters of every class of units in one configuration, stored as
+     * arrays indexed by class, along with the AgingSchedule of each class that doesn't
+     * age at its average rate (see Unit::piecewise) and whether there are any.  When
+     * attributing failures, it also has the reliability of each class for each
+     * failure mechanism, stored by class.
+     */
+    struct Parameters
+    {
+        std::vector<double> alphas;
+        std::vector<double> betas;
+        std::vector<const AgingSchedule*> schedules;
+        bool scheduled;
+        std::vector<WeibullDistribution> mechanisms;
+    };
+
+    bool verbose;
+    size_t max_states;
+    std::unique_ptr<ConfigurationTable> configs;
+    std::vector<std::shared_ptr<Unit>> simulated; // Units that aren't in collapsed groups
+    std::vector<UnitClass> classes;
+
+    // Groups that are simulated as single units (see Simulation::collapse) and their
+    // reliability functions
+    std::vector<std::shared_ptr<Group>> collapsed;
+    std::vector<TabulatedReliability> tables;
+
+    /**
+     * What happens when a given set of units and collapsed groups has failed outside
+     * the enumerated states: whether the system has failed and, if not, the
+     * parameters of its configuration, and (computed separately, since the set of
+     * failures right after an event differs from the one simulated next) which
+     * components have failed and which units and groups fail because their parents
+     * have.
+     */
+    struct Unlisted
+    {
+        bool resolved = false;
+        bool down = false;
+        const Parameters* p = nullptr;
+        Parameters parameters;  // If the configuration isn't in the ConfigurationTable
+        bool walked = false;
+        std::vector<std::shared_ptr<Component>> failed;
+        std::vector<std::shared_ptr<Unit>> orphans;
+        std::vector<std::shared_ptr<Group>> orphaned;
+    };
+
+    // Parameters for each configuration in the ConfigurationTable, filled in when it's
+    // first reached
+    std::vector<Parameters> parameters;
+
+    // Sets of failures reached outside the enumerated states, keyed by which of
+    // simulated and then collapsed have failed, up to max_states of them, and space
+    // for the last two sets reached once there are that many
+    std::unordered_map<std::vector<bool>, Unlisted> unlisted;
+    Unlisted spare[2];
+    std::vector<bool> key;
+
+    // State of each class during an iteration: its number of healthy members, its age
+    // in the current configuration, and its current reliability
+    std::vector<double> healthy;
+    std::vector<double> ages;
+    std::vector<double> reliabilities;
+    std::vector<double> hazards;
+
+    // Times from now at which the current copy and then each serial spare of each
+    // class's unit would fail, as far as they were sampled (see next_event)
+    std::vector<std::vector<double>> chains;
+
+    // States the system can reach (see Simulation::enumerate), stored by state with an
+    // entry for each class and then each collapsed group: the number of healthy members
+    // (1 or 0 for groups), the state after one of them fails or npos if it wasn't
+    // explored, and the range of groups in recorded that fail along with it.  Each
+    // state's configuration is an ID in the ConfigurationTable, or npos if the system
+    // has failed.
+    std::vector<uint32_t> counts;
+    std::vector<size_t> transitions;
+    std::vector<size_t> offsets;
+    std::vector<Component*> recorded;
+    std::vector<size_t> configurations;
+
+    // Whether iterations never leave the enumerated states and classes age uniformly,
+    // so they can run in lockstep, and whether every class's Weibull shape is 2 then
+    bool lockstep;
+    bool squared;
+
+    // Failure mechanisms to attribute unit failures to and running totals of their
+    // hazards (see Simulation::attribute)
+    std::vector<std::shared_ptr<FailureMechanism>> causes;
+    std::vector<double> shares;
+
+    // Failure IDs of the units and collapsed groups that have failed so far in the
+    // current iteration, in order (see Simulation::names)
+    FailureSequences::sequence_t sequence;
+
+    void connect(const pugi::xml_document& doc);
+    void collapse_static();
+    void enumerate();
+    const Parameters& configure(const Unit::config_t& config, size_t id, Parameters* scratch=nullptr);
+    Unlisted& lookup(const Parameters* previous);
+    Unlisted& resolve(const Parameters* previous);
+    Unlisted& walk(const Parameters* previous);
+    double next_event(const Parameters& p, double t, std::mt19937& gen, size_t& failed);
+    double competing_event(const Parameters& p, double t, std::mt19937& gen, size_t& failed);
+    void advance(const Parameters* previous, const Parameters& p, double t, double dt);
+    void spend(const Parameters& p, double t, double dt, std::mt19937& gen);
+    void attribute(const Parameters& p, size_t i, double t, std::mt19937& gen);
+    void run_lanes(int iterations, std::mt19937& gen);
+
+  public:
+    static Sampler sampler;
+    static bool collapse;
+    static size_t lanes;
+    static bool attribution;
+    static ThreadPool* pool;
+
+    std::vector<std::shared_ptr<Unit>> units;
+    std::shared_ptr<Component> root;
+    FailureSequences sequences;
+
+    static std::vector<std::shared_ptr<Unit>> create_units(const pugi::xml_document& doc);
+
+    Simulation(const pugi::xml_document& doc, size_t max_configurations, bool v=false);
+    Simulation(const Simulation& other, const pugi::xml_document& doc, bool local=false);
+    std::shared_ptr<Unit> unit(const std::string& name) const;
+    std::vector<std::string> names() const;
+    AggregationStatistics prepare(const std::set<std::shared_ptr<FailureMechanism>>& mechanisms, ReliabilityCache& cache, bool lumping=true);
+    void run(int iterations, std::mt19937& gen);
+    void run(int iterations, std::mt19937& gen, const std::vector<std::unique_ptr<Simulation>>& copies, size_t chunk);
+    void merge(const Simulation& other);
+    void clear();
+};
+
+} // namespace oldspot
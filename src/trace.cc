@@ -1,16 +1,23 @@
 #include "trace.hh"
 
 #include <algorithm>
+#include <climits>
+#include <condition_variable>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <set>
 #include <stdexcept>
 #include <sstream>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <tuple>
 #include <utility>
 #include <vector>
 
@@ -21,27 +28,49 @@ namespace oldspot
 
 using namespace std;
 
+// Whether to store values from trace files as floats rather than doubles
+bool Trace::single_precision = false;
+
+/**
+ * Get the value of a quantity at this DataPoint.
+ */
+double
+DataPoint::at(const string& quantity) const
+{
+    return trace->value(quantity, row);
+}
+
+/**
+ * Check if the trace containing this DataPoint has a value for a quantity (1 if it
+ * does and 0 otherwise).
+ */
+size_t
+DataPoint::count(const string& quantity) const
+{
+    return trace->contains(quantity) ? 1 : 0;
+}
+
 /**
  * Push a string representation of a DataPoint onto a stream.
  */
 ostream&
 operator<<(ostream& stream, const DataPoint& point)
 {
+    vector<string> quantities = point.trace->quantities();
     stream << point.time << ":{";
-    stream << accumulate(next(point.data.begin()), point.data.end(),
-                         point.data.begin()->first + ':' + to_string(point.data.begin()->second),
-                         [](string a, const pair<string, double>& b){ return a + ',' + b.first + ':' + to_string(b.second); });
+    stream << accumulate(next(quantities.begin()), quantities.end(),
+                         quantities.front() + ':' + to_string(point.at(quantities.front())),
+                         [&](string a, const string& b){ return a + ',' + b + ':' + to_string(point.at(b)); });
     return stream << "}";
 }
 
 /**
- * Parse a trace file to get a list of DataPoints.  Each trace file should be a table
- * delimited with the given delimiter (default is comma) where each row is a point in
- * the trace and each column is a quantity in the trace, with the first row containing
- * headers.  The first column must be the time at which the data point occurs.
+ * Parse a trace file.  Each trace file should be a table delimited with the given
+ * delimiter (default is comma) where each row is a point in the trace and each column
+ * is a quantity in the trace, with the first row containing headers.  The first column
+ * must be the time at which the data point occurs.
  */
-vector<DataPoint>
-parseTrace(const string fname, char delimiter)
+Trace::Trace(const string& fname, char delimiter)
 {
     ifstream file(fname);
     if (!file)
@@ -51,26 +80,299 @@ parseTrace(const string fname, char delimiter)
     }
 
     string line;
-    vector<DataPoint> trace;
-    
+
     // Parse unit names
     getline(file, line); // Get line containing unit names
     vector<string> quantities = split(line, delimiter);
     quantities.erase(quantities.begin());
 
-    // Parse times (first column) and values
+    // Parse times (first column) and values, merging rows that repeat the previous one
+    vector<Segment> s;
+    vector<vector<double>> values(single_precision ? 0 : quantities.size());
+    vector<vector<float>> floats(single_precision ? quantities.size() : 0);
+    vector<double> row(quantities.size());
     double prev = 0;
-    while (getline(file, line))
+    for (_rows = 0; getline(file, line); _rows++)
     {
-        unordered_map<string, double> data;
-        vector<string> values = split(line, delimiter);
-        double time = stod(values[0]); // First column should be time
+        vector<string> tokens = split(line, delimiter);
+        double time = stod(tokens[0]); // First column should be time
         for (size_t i = 0; i < quantities.size(); i++)
-            data[quantities[i]] = stod(values[i + 1]);
-        trace.push_back({time, time - prev, data});
+            row[i] = single_precision ? (float)stod(tokens[i + 1]) : stod(tokens[i + 1]);
+
+        bool repeat = !s.empty() && s.back().duration == time - prev;
+        for (size_t i = 0; repeat && i < quantities.size(); i++)
+            repeat = (single_precision ? floats[i].back() : values[i].back()) == row[i];
+        if (repeat)
+            s.back().rows++;
+        else
+        {
+            s.push_back({time, time - prev, 1});
+            for (size_t i = 0; i < quantities.size(); i++)
+            {
+                if (single_precision)
+                    floats[i].push_back(row[i]);
+                else
+                    values[i].push_back(row[i]);
+            }
+        }
         prev = time;
     }
 
+    segments = make_shared<const vector<Segment>>(move(s));
+    for (size_t i = 0; i < quantities.size(); i++)
+    {
+        Column& column = columns[quantities[i]] = {nullptr, nullptr, 0, 1};
+        if (single_precision)
+            column.floats = make_shared<const vector<float>>(move(floats[i]));
+        else
+            column.values = make_shared<const vector<double>>(move(values[i]));
+    }
+}
+
+/**
+ * Create a trace with a single point in which each quantity has the given value.  By
+ * default, it has unit duration and occurs at time 1.
+ */
+Trace::Trace(const unordered_map<string, double>& constants, double time, double duration)
+    : segments(make_shared<const vector<Segment>>(1, Segment{time, duration, 1})), _rows(1)
+{
+    for (const auto& c: constants)
+        columns[c.first] = {nullptr, nullptr, c.second, 1};
+}
+
+/**
+ * Get the total amount of time covered by this trace.
+ */
+double
+Trace::length() const
+{
+    double total = 0;
+    for (size_t i = 0; i < size(); i++)
+        total += length(i);
+    return total;
+}
+
+/**
+ * Get the names of the quantities in this trace.
+ */
+vector<string>
+Trace::quantities() const
+{
+    vector<string> names;
+    for (const auto& column: columns)
+        names.push_back(column.first);
+    sort(names.begin(), names.end());
+    return names;
+}
+
+/**
+ * Get the value of a quantity at row i.
+ */
+double
+Trace::value(const string& quantity, size_t i) const
+{
+    const Column& column = columns.at(quantity);
+    if (column.values)
+        return (*column.values)[i]*column.scale;
+    else if (column.floats)
+        return (*column.floats)[i]*column.scale;
+    else
+        return column.constant*column.scale;
+}
+
+/**
+ * Give a quantity a constant value throughout this trace if it doesn't already have
+ * values.
+ */
+void
+Trace::set_default(const string& quantity, double value)
+{
+    columns.emplace(quantity, Column{nullptr, nullptr, value, 1});
+}
+
+/**
+ * Replace every value of a quantity with a constant.  The value is in the same units
+ * as the quantity's existing values, so it is scaled the same way they are.
+ */
+void
+Trace::set(const string& quantity, double value)
+{
+    auto column = columns.find(quantity);
+    columns[quantity] = {nullptr, nullptr, value, column == columns.end() ? 1 : column->second.scale};
+}
+
+/**
+ * Multiply every value of a quantity by a factor (i.e. to convert units).
+ */
+void
+Trace::scale(const string& quantity, double factor)
+{
+    auto column = columns.find(quantity);
+    if (column != columns.end())
+        column->second.scale *= factor;
+}
+
+/**
+ * Check if two traces have the same values for the same quantities at the same times.
+ */
+bool
+Trace::operator==(const Trace& other) const
+{
+    if (size() != other.size() || columns.size() != other.columns.size())
+        return false;
+    for (size_t i = 0; i < size(); i++)
+        if (time(i) != other.time(i) || duration(i) != other.duration(i) || rows(i) != other.rows(i))
+            return false;
+    for (const auto& column: columns)
+    {
+        if (!other.contains(column.first))
+            return false;
+        for (size_t i = 0; i < size(); i++)
+            if (value(column.first, i) != other.value(column.first, i))
+                return false;
+    }
+    return true;
+}
+
+/**
+ * Start reading a stream of trace rows by parsing its header.
+ */
+TraceStream::TraceStream(istream& s, char d) : stream(s), delimiter(d), line(1)
+{
+    string header;
+    if (!getline(stream, header))
+    {
+        cerr << "error: trace stream ended before its header" << endl;
+        exit(1);
+    }
+    quantities = split(header, delimiter);
+    if (quantities.size() < 2)
+    {
+        cerr << "error: trace stream header needs unit and time columns" << endl;
+        exit(1);
+    }
+    quantities.erase(quantities.begin(), quantities.begin() + 2);
+}
+
+/**
+ * Wait for the next row in the stream and get its unit name, time, and values.
+ * Returns false when the stream ends.
+ */
+bool
+TraceStream::next(string& unit, double& time, unordered_map<string, double>& values)
+{
+    string row;
+    do
+    {
+        if (!getline(stream, row))
+            return false;
+        line++;
+    } while (row.empty());
+
+    vector<string> tokens = split(row, delimiter);
+    if (tokens.size() != quantities.size() + 2)
+    {
+        cerr << "error: trace stream line " << line << " has " << tokens.size()
+             << " values, but its header has " << quantities.size() + 2 << endl;
+        exit(1);
+    }
+    unit = tokens[0];
+    values.clear();
+    size_t i = 1;
+    try
+    {
+        time = stod(tokens[1]);
+        for (i = 2; i < tokens.size(); i++)
+            values[quantities[i - 2]] = stod(tokens[i]);
+    }
+    catch (const logic_error&)
+    {
+        cerr << "error: trace stream line " << line << " has value \"" << tokens[i]
+             << "\" in column " << i + 1 << ", which is not a number" << endl;
+        exit(1);
+    }
+    return true;
+}
+
+namespace
+{
+
+TraceStatistics statistics = {0, 0};
+
+}
+
+/**
+ * Get the total numbers of rows read from trace files so far and of segments they
+ * were compressed into.
+ */
+TraceStatistics
+traceStatistics()
+{
+    return statistics;
+}
+
+/**
+ * Get a trace that has had missing values filled in from the given defaults and
+ * frequencies converted from MHz to Hz.  Traces are kept in a store shared by the
+ * whole program.  Each file is only parsed once for each delimiter, and traces with
+ * different defaults share its columns; a trace that has already been loaded with
+ * the same defaults and delimiter is shared as a whole.  If fname is empty, the
+ * trace has one point consisting only of default values.
+ *
+ * Several threads can load traces at once.  Files are parsed without holding the
+ * store's lock, so different files are parsed in parallel, and a thread that needs a
+ * file another thread is parsing waits for it instead of parsing it again.
+ */
+shared_ptr<const Trace>
+loadTrace(const string& fname, const unordered_map<string, double>& defaults, char delimiter)
+{
+    typedef tuple<string, char, map<string, double>> Key;
+    static map<pair<string, char>, weak_ptr<const Trace>> parsed;
+    static map<Key, weak_ptr<const Trace>> store;
+    static set<pair<string, char>> parsing;
+    static mutex lock;
+    static condition_variable finished;
+
+    string path = fname;
+    char resolved[PATH_MAX];
+    if (!fname.empty() && realpath(fname.c_str(), resolved))
+        path = resolved;
+    Key key(path, delimiter, map<string, double>(defaults.begin(), defaults.end()));
+
+    unique_lock<mutex> guard(lock);
+    shared_ptr<const Trace> cached = store[key].lock();
+    if (cached)
+        return cached;
+
+    shared_ptr<Trace> trace;
+    if (fname.empty())
+        trace = make_shared<Trace>(defaults);
+    else
+    {
+        pair<string, char> source(path, delimiter);
+        finished.wait(guard, [&]{ return parsing.count(source) == 0; });
+        shared_ptr<const Trace> file = parsed[source].lock();
+        if (!file)
+        {
+            parsing.insert(source);
+            guard.unlock();
+            file = make_shared<const Trace>(fname, delimiter);
+            guard.lock();
+            parsing.erase(source);
+            finished.notify_all();
+            parsed[source] = file;
+            statistics.rows += file->rows();
+            statistics.segments += file->size();
+        }
+        cached = store[key].lock(); // In case another thread finished it while waiting
+        if (cached)
+            return cached;
+        trace = make_shared<Trace>(*file);
+        for (const auto& d: defaults)
+            trace->set_default(d.first, d.second);
+    }
+    trace->scale("frequency", 1e6); // Expecting MHz; convert to Hz
+    store[key] = trace;
     return trace;
 }
 
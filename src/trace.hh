@@ -1,7 +1,9 @@
 #pragma once
 
 #include <cstdlib>
+#include <istream>
 #include <limits>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <unordered_map>
@@ -12,21 +14,126 @@
 namespace oldspot
 {
 
+class Trace;
+
 /**
  * Data point in an activity trace for a unit.  It contains a time at which it
- * occurs, the duration of the segment, and a map of quantities onto their values
- * for that segment (i.e. temperature, voltage, frequency, etc., depending on
- * which quantities are needed to compute reliability).
+ * occurs, the duration of each row in its segment, and access to the quantities
+ * in the trace for that segment (i.e. temperature, voltage, frequency, etc.,
+ * depending on which quantities are needed to compute reliability).
  */
 struct DataPoint
 {
+    const Trace* trace;
+    size_t row;
     double time;
     double duration;
-    std::unordered_map<std::string, double> data;
+
+    double at(const std::string& quantity) const;
+    size_t count(const std::string& quantity) const;
 
     friend std::ostream& operator<<(std::ostream& stream, const DataPoint& point);
 };
 
-std::vector<DataPoint> parseTrace(const std::string fname, char delimiter=',');
+/**
+ * Activity trace for a unit, stored by column.  Each quantity either has a value
+ * for every row or is constant across the trace (i.e. a default value for a
+ * quantity the trace file doesn't contain), and its values can be scaled to
+ * convert units.  Columns are shared among copies of a trace, so overlaying
+ * defaults or conversions onto a trace doesn't copy or touch its rows.
+ *
+ * Consecutive rows with the same duration and values are stored once as a
+ * segment along with the number of rows it represents.  Aging rates are
+ * duration-weighted averages, so evaluating each segment once and weighting it
+ * by its length gives the same result as evaluating every row.  Rows have to have
+ * the same duration as well as the same values because some quantities are per row
+ * (e.g. Logic units divide a row's activity by its duration), so a DataPoint's
+ * duration is that of one of its rows rather than of the whole segment.
+ *
+ * With Trace::single_precision, values read from trace files are stored as floats,
+ * which halves the memory their columns take.  Times and durations are still doubles
+ * since rounding them would accumulate over long traces.
+ */
+class Trace
+{
+  private:
+    struct Column
+    {
+        std::shared_ptr<const std::vector<double>> values;
+        std::shared_ptr<const std::vector<float>> floats; // In place of values (see Trace::single_precision)
+        double constant;
+        double scale;
+    };
+
+    struct Segment
+    {
+        double time;
+        double duration;
+        size_t rows;
+    };
+
+    std::shared_ptr<const std::vector<Segment>> segments;
+    std::unordered_map<std::string, Column> columns;
+    size_t _rows;
+
+  public:
+    static bool single_precision;
+
+    Trace(const std::string& fname, char delimiter=',');
+    Trace(const std::unordered_map<std::string, double>& constants, double time=1, double duration=1);
+
+    size_t size() const { return segments->size(); }
+    size_t rows() const { return _rows; }
+    size_t rows(size_t i) const { return (*segments)[i].rows; }
+    double time(size_t i) const { return (*segments)[i].time; }
+    double duration(size_t i) const { return (*segments)[i].duration; }
+    double length(size_t i) const { return (*segments)[i].duration*(*segments)[i].rows; }
+    double length() const;
+    std::vector<std::string> quantities() const;
+    bool contains(const std::string& quantity) const { return columns.count(quantity) > 0; }
+
+    double value(const std::string& quantity, size_t i) const;
+    DataPoint operator[](size_t i) const { return {this, i, time(i), duration(i)}; }
+
+    void set_default(const std::string& quantity, double value);
+    void set(const std::string& quantity, double value);
+    void scale(const std::string& quantity, double factor);
+
+    bool operator==(const Trace& other) const;
+};
+
+/**
+ * Total numbers of rows read from trace files and of segments they were stored as.
+ */
+struct TraceStatistics
+{
+    size_t rows;
+    size_t segments;
+};
+
+TraceStatistics traceStatistics();
+
+/**
+ * Reader for trace rows for many units that arrive while they are being produced
+ * (e.g. through a pipe from a running simulation).  The first line is a header,
+ * and each row after it contains the name of a unit, a time, and then values of the
+ * quantities named in the header.  Each unit's rows should be in order of time.
+ */
+class TraceStream
+{
+  private:
+    std::istream& stream;
+    char delimiter;
+    std::vector<std::string> quantities;
+    size_t line;
+
+  public:
+    TraceStream(std::istream& s, char d=',');
+    bool next(std::string& unit, double& time, std::unordered_map<std::string, double>& values);
+};
+
+std::shared_ptr<const Trace> loadTrace(const std::string& fname,
+                                       const std::unordered_map<std::string, double>& defaults,
+                                       char delimiter=',');
 
-} // namespace oldspot
\ No newline at end of file
+} // namespace oldspot
@@ -1,6 +1,7 @@
 #include "unit.hh"
 
 #include <algorithm>
+#include <array>
 #include <bitset>
 #include <cmath>
 #include <cstdint>
@@ -10,11 +11,17 @@
 #include <iostream>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <pugixml.hpp>
+#include <queue>
 #include <random>
 #include <set>
 #include <sstream>
+#include <string>
+#include <tuple>
+#include <typeindex>
+#include <typeinfo>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
@@ -43,29 +50,90 @@ operator<<(ostream& os, const Unit::config_t& config)
                                    [](const string& a, const string& b){ return a + ',' + b; }) << ']';
 }
 
+/**
+ * Get the string representation of a configuration.
+ */
+static string
+str(const Unit::config_t& config)
+{
+    stringstream stream;
+    stream << config;
+    return stream.str();
+}
+
+/**
+ * Record that this Component failed at time t in a Monte Carlo iteration.  Its mean
+ * and variance are accumulated as failures are recorded (the variance with Welford's
+ * method, which stays accurate when the mean is much larger than the spread), so the
+ * times themselves only need to be kept for dumping them as text.
+ */
+void
+Component::record(double t)
+{
+    double before = _failures > 0 ? sum/_failures : 0;
+    _failures++;
+    sum += t;
+    m2 += (t - before)*(t - sum/_failures);
+    if (keep)
+        ttfs.push_back(t);
+    histogram.add(t);
+    if (dump_file)
+        dump_file->write(channel, t);
+}
+
+/**
+ * Add the failures recorded by another Component (e.g. the same one in a copy of the
+ * system that was simulated at the same time) to this one's, combining their means
+ * and variances as in:
+ * [1] Chan, T. F., Golub, G. H., and LeVeque, R. J. Updating formulae and a pairwise
+ *     algorithm for computing sample variances.  COMPSTAT 1982.
+ */
+void
+Component::merge(const Component& other)
+{
+    if (other._failures == 0)
+        return;
+    double delta = other.sum/other._failures - (_failures > 0 ? sum/_failures : 0);
+    size_t n = _failures + other._failures;
+    m2 += other.m2 + delta*delta*_failures*other._failures/n;
+    _failures = n;
+    sum += other.sum;
+    ttfs.insert(ttfs.end(), other.ttfs.begin(), other.ttfs.end());
+    histogram.merge(other.histogram);
+}
+
+/**
+ * Forget all recorded failures.
+ */
+void
+Component::clear()
+{
+    _failures = 0;
+    sum = 0;
+    m2 = 0;
+    ttfs.clear();
+    histogram.clear();
+}
+
 /**
  * Get the mean of the times to failure of this Component.
  */
 double
 Component::mttf() const
 {
-    if (ttfs.empty())
+    if (_failures == 0)
         return numeric_limits<double>::quiet_NaN();
     else
-        return accumulate(ttfs.begin(), ttfs.end(), 0.0)/ttfs.size();
+        return sum/_failures;
 }
 
 double
 Component::stdttf() const
 {
-    if (ttfs.size() <= 1)
+    if (_failures <= 1)
         return numeric_limits<double>::quiet_NaN();
     else
-    {
-        double mean = mttf();
-        return sqrt(accumulate(ttfs.begin(), ttfs.end(), 0.0,
-                               [&](double a, double b){ return a + pow(b - mean, 2); })/(ttfs.size() - 1));
-    }
+        return sqrt(m2/(_failures - 1));
 }
 
 /**
@@ -76,14 +144,12 @@ Component::stdttf() const
 pair<double, double>
 Component::mttf_interval(double confidence) const
 {
-    if (ttfs.size() <= 1)
+    if (_failures <= 1)
         return {numeric_limits<double>::quiet_NaN(), numeric_limits<double>::quiet_NaN()};
     else
     {
-        double mean = mttf();
-        double s = sqrt(accumulate(ttfs.begin(), ttfs.end(), 0.0,
-                                   [&](double a, double b){ return a + pow(b - mean, 2); })/(ttfs.size() - 1));
-        return {mean - 1.96*s/sqrt(ttfs.size()), mean + 1.96*s/sqrt(ttfs.size())};
+        double mean = mttf(), s = stdttf();
+        return {mean - 1.96*s/sqrt(_failures), mean + 1.96*s/sqrt(_failures)};
     }
 }
 
@@ -96,11 +162,22 @@ operator<<(ostream& stream, const Component& c)
     return c.dump(stream);
 }
 
+// Whether Components keep every time to failure rather than only their statistics
+bool Component::keep = false;
+
 // Default delimiter for parsing trace files
 char Unit::delim = ',';
+// Default policy for configurations without a declared trace
+Unit::Fallback Unit::fallback = Unit::Fallback::FRESH;
+// Relative error allowed when aggregating trace segments (0 means no aggregation)
+double Unit::tolerance = 0;
+// Whether to age units according to where they are in their profiles rather than at their average rates
+bool Unit::piecewise = false;
 // config_t that specifies a "fresh" system (all units healthy)
 const Unit::config_t Unit::fresh = {""};
 
+constexpr size_t ConfigurationTable::npos;
+
 /**
  * Check for units whose parent groups have reported failure and then mark them
  * as having failed.
@@ -108,17 +185,22 @@ const Unit::config_t Unit::fresh = {""};
 vector<shared_ptr<Unit>>
 Unit::parents_failed(const shared_ptr<Component>& root, const vector<shared_ptr<Unit>>& units)
 {
-    vector<shared_ptr<Unit>> failed(units.begin(), units.end());
+    unordered_set<shared_ptr<Component>> reached;
     Component::conditional_walk(root, [&](const shared_ptr<Component>& c){
         if (c->failed())
             return false;
-        shared_ptr<Unit> u = dynamic_pointer_cast<Unit>(c);
-        if (u)
-            failed.erase(remove(failed.begin(), failed.end(), u));
+        reached.insert(c);
         return true;
     });
-    for (shared_ptr<Unit>& unit: failed)
-        unit->_failed = true;
+    vector<shared_ptr<Unit>> failed;
+    for (const shared_ptr<Unit>& unit: units)
+    {
+        if (reached.count(unit) == 0)
+        {
+            unit->_failed = true;
+            failed.push_back(unit);
+        }
+    }
     return failed;
 }
 
@@ -131,12 +213,17 @@ Unit::parents_failed(const shared_ptr<Component>& root, const vector<shared_ptr<
  * there are and whether they are parallel or serial (i.e. if they are shadow copies
  * or take over when older ones fail).  Configurations are specified as sets of
  * names of units that have failed.
+ *
+ * A configuration can have a profile instead of a trace, which lists phases that
+ * each have a trace file and either a weight, which is the fraction of time spent
+ * in that phase, or a number of times the trace is repeated (1 by default).
  * 
  * The ID of each unit should be unique.
  */
 Unit::Unit(const xml_node& node, unsigned int i, const unordered_map<string, double>& defaults)
     : Component(node.attribute("name").value()),
-      age(0), copies(1), _current_reliability(1), _failed(false), remaining(1), serial(true), config({}), prev_config({}), id(i)
+      copies(1), _failed(false), remaining(1), serial(true),
+      streamed_time(0), distributions(make_shared<Distributions>()), id(i)
 {
     unordered_map<string, double> def(defaults.begin(), defaults.end());
 
@@ -152,6 +239,7 @@ Unit::Unit(const xml_node& node, unsigned int i, const unordered_map<string, dou
     for (const xml_node& d: node.children("default"))
         for (const xml_attribute& a: d.attributes())
             def[a.name()] = a.as_double();
+    this->defaults = def;
 
     if (node.child("redundancy"))
     {
@@ -160,28 +248,67 @@ Unit::Unit(const xml_node& node, unsigned int i, const unordered_map<string, dou
         copies = remaining = redundancy.attribute("count").as_int();
     }
 
-    if (node.child("trace"))
+    for (const xml_node& child: node.children())
     {
-        for (const xml_node& child: node.children("trace"))
+        if (strcmp(child.name(), "trace") != 0 && strcmp(child.name(), "profile") != 0)
+            continue;
+        vector<string> failed_vector = split(child.attribute("failed").value(), ',');
+        config_t failed(failed_vector.begin(), failed_vector.end());
+        if (strcmp(child.name(), "trace") == 0)
         {
-            vector<DataPoint> trace = parseTrace(child.attribute("file").value(), delim);
-            vector<string> failed_vector = split(child.attribute("failed").value(), ',');
-            config_t failed(failed_vector.begin(), failed_vector.end());
-
-            for (const auto& d: def)
-                for (DataPoint& data: trace)
-                    if (data.data.count(d.first) == 0)
-                        data.data[d.first] = d.second;
-            traces[failed] = trace;
+            trace_t trace = loadTrace(child.attribute("file").value(), def, delim);
+            profiles[failed] = {{trace, trace->length(), 1}};
+            continue;
         }
+
+        vector<Phase> phases;
+        bool weighted = false, repeated = false;
+        for (const xml_node& phase: child.children("phase"))
+        {
+            trace_t trace = loadTrace(phase.attribute("file").value(), def, delim);
+            if (phase.attribute("weight"))
+            {
+                weighted = true;
+                phases.push_back({trace, phase.attribute("weight").as_double(), 0});
+            }
+            else
+            {
+                repeated = true;
+                int repeat = phase.attribute("repeat").as_int(1);
+                phases.push_back({trace, repeat*trace->length(), repeat});
+            }
+            if (phases.back().duration <= 0 || (phase.attribute("weight") && phase.attribute("repeat")))
+            {
+                cerr << "unit " << name << ": profile phases need either a positive weight or a positive repeat count" << endl;
+                exit(1);
+            }
+        }
+        if (phases.empty() || (weighted && repeated))
+        {
+            cerr << "unit " << name << ": profile must have phases that either all have weights or all have repeat counts" << endl;
+            exit(1);
+        }
+        profiles[failed] = phases;
+    }
+    if (profiles.count(fresh) == 0)
+    {
+        trace_t trace = loadTrace("", def, delim);
+        profiles[fresh] = {{trace, trace->length(), 1}};
     }
-    if (traces.count(fresh) == 0)
-        traces[fresh] = {{1, 1, def}};
-    for (auto& trace: traces)
-        for (DataPoint& data: trace.second)
-            data.data["frequency"] *= 1e6; // Expecting MHz; convert to Hz
 }
 
+/**
+ * Constructor for a replica of a Unit, which is identical to the original except
+ * for its name and ID.  The replica shares its traces and reliability functions
+ * with the original, so they are only stored and computed once.
+ */
+Unit::Unit(const Unit& other, const string& n, unsigned int i)
+    : Component(n),
+      copies(other.copies), _failed(false), remaining(other.copies), serial(other.serial),
+      defaults(other.defaults), streamed(other.streamed), streamed_time(other.streamed_time),
+      profiles(other.profiles), distributions(other.distributions), id(i)
+{}
+
 /**
  * Units don't have children, so return an empty vector.
  */
@@ -193,31 +320,51 @@ Unit::children()
 }
 
 /**
- * Reset the unit's reliability and age to being fresh.
+ * Reset the unit to being fresh, with all of its redundant copies available.
  */
 void
 Unit::reset()
 {
-    age = 0;
-    _current_reliability = 1;
     _failed = false;
     remaining = copies;
 }
 
 /**
- * Determine the configuration of failed units and set this Unit's reliability function
- * based on that.
+ * Give the given units their own copies of the reliability functions they share with
+ * the units they were replicated from, allocated by the calling thread so they're in
+ * memory close to it.  Units among them that shared reliability functions still do.
  */
 void
-Unit::set_configuration(const shared_ptr<Component>& root)
+Unit::localize(const vector<shared_ptr<Unit>>& units)
+{
+    unordered_map<const Distributions*, shared_ptr<Distributions>> copied;
+    for (const shared_ptr<Unit>& unit: units)
+    {
+        shared_ptr<Distributions>& local = copied[unit->distributions.get()];
+        if (!local)
+        {
+            local = make_shared<Distributions>();
+            lock_guard<mutex> guard(unit->distributions->lock);
+            local->mechanisms = unit->distributions->mechanisms;
+            local->overall = unit->distributions->overall;
+            local->schedules = unit->distributions->schedules;
+        }
+        unit->distributions = local;
+    }
+}
+
+/**
+ * Determine the configuration of failed components in the system, which is the set
+ * of names of the failed components closest to the root of the failure dependency
+ * graph.
+ */
+Unit::config_t
+Unit::configuration(const shared_ptr<Component>& root)
 {
-    if (_failed)
-        warn("setting configuration for failed unit %s\n", name.c_str());
     if (root->failed())
-        warn("setting configuration for failed system\n");
+        WARN("setting configuration for failed system\n");
 
-    prev_config = config;
-    config.clear();
+    config_t config;
     conditional_walk(root, [&](const shared_ptr<Component>& c){
         if (c->failed())
         {
@@ -228,46 +375,77 @@ Unit::set_configuration(const shared_ptr<Component>& root)
     });
     if (config.empty())
         config.insert("");
+    return config;
+}
 
-    if (traces.count(config) == 0)
+/**
+ * Find the trace this Unit should use when the system is in configuration c and
+ * return the configuration it's for.  If there is no trace for c, fall back to
+ * another according to Unit::fallback.
+ */
+const Unit::config_t*
+Unit::resolve(const config_t& c) const
+{
+    auto profile = profiles.find(c);
+    if (profile != profiles.end())
+        return &profile->first;
+
+    if (fallback == Fallback::SUBSET)
     {
-        stringstream c, f;
-        c << config;
-        f << fresh;
-        warn("can't find configuration %s for %s; using configuration %s\n", c.str().c_str(), name.c_str(), f.str().c_str());
-        config = fresh;
+        // Find the largest declared configuration contained in c, breaking ties by name
+        const config_t* match = nullptr;
+        set<string> best;
+        for (const auto& profile: profiles)
+        {
+            set<string> names;
+            for (const string& name: profile.first)
+                if (!name.empty())
+                    names.insert(name);
+            if (!all_of(names.begin(), names.end(), [&](const string& n){ return c.count(n) > 0; }))
+                continue;
+            if (!match || names.size() > best.size() || (names.size() == best.size() && names < best))
+            {
+                match = &profile.first;
+                best = names;
+            }
+        }
+        if (match)
+            return match;
     }
+    return &profiles.find(fresh)->first;
 }
 
 /**
- * Determine the next event this Unit experiences relative to the time of the previous
- * event.  Currently this only means the time at which this Unit will fail.
+ * Get this Unit's reliability function when the system is in configuration c, whose
+ * index in the ConfigurationTable is i.
  */
-double
-Unit::get_next_event() const
+const WeibullDistribution&
+Unit::distribution(const config_t& c, size_t i) const
 {
-    static random_device dev;
-    static mt19937 gen(dev());
-    uniform_real_distribution<double> r(0, _current_reliability);
-    double next = inverse(r(gen));
-    if (isinf(next))
-        return numeric_limits<double>::infinity();
-    return next - inverse(_current_reliability);
+    return distributions->overall.at(i < resolved.size() && resolved[i] ? *resolved[i] : *resolve(c));
 }
 
 /**
- * Update this Unit's reliability for the current simulation time.  This must
- * be shifted according to:
- * [1] Bolchini, C., Carminati, M., Gribaudo, M., and Miele, A. A lightweight and
- *     open-source framework for the lifetime estimation of multicore systems. ICCD 2014.
+ * Get the reliability function for one failure mechanism in configuration c, whose
+ * ID is i as for Unit::distribution.
  */
-void
-Unit::update_reliability(double dt)
+const WeibullDistribution&
+Unit::distribution(const config_t& c, size_t i, const shared_ptr<FailureMechanism>& mechanism) const
 {
-    age += dt;
-    if (!prev_config.empty())
-        age -= inverse(prev_config, _current_reliability) - inverse(config, _current_reliability);
-    _current_reliability = reliability(age);
+    return distributions->mechanisms.at(i < resolved.size() && resolved[i] ? *resolved[i] : *resolve(c)).at(mechanism);
+}
+
+/**
+ * Get the AgingSchedule for configuration c, whose ID is i as for Unit::distribution,
+ * or nullptr if this Unit ages at its average rate in it.
+ */
+const AgingSchedule*
+Unit::schedule(const config_t& c, size_t i) const
+{
+    if (distributions->schedules.empty())
+        return nullptr;
+    auto schedule = distributions->schedules.find(i < resolved.size() && resolved[i] ? *resolved[i] : *resolve(c));
+    return schedule == distributions->schedules.end() ? nullptr : &schedule->second;
 }
 
 /**
@@ -277,32 +455,426 @@ Unit::update_reliability(double dt)
 double
 Unit::activity(const DataPoint& data, const shared_ptr<FailureMechanism>& mechanism) const
 {
-    return data.data.at("activity");
+    return data.at("activity");
 }
 
+/**
+ * Compute the MTTF of a trace for a failure mechanism in pieces that can be combined
+ * into a reliability function.  Without a tolerance, each segment of the trace is a
+ * piece.  Otherwise, adjacent segments are aggregated adaptively, as in adaptive
+ * quadrature: starting from the whole trace, the aging rate of a range of segments is
+ * compared with the combined rates of its two halves, and if they differ by no more
+ * than the tolerance (relative to the halves), the halves are kept; otherwise each half
+ * is refined in turn until it is short enough to evaluate every segment.  Ranges are always split a few times
+ * before being accepted so that variation within a long trace isn't hidden by
+ * aggregating all of it.
+ *
+ * The rate of a range is estimated from the distribution of each quantity (and of the
+ * duty cycle) over it rather than only from their means, since aging is very
+ * nonlinear in quantities like temperature.  Each quantity's effect is averaged with a
+ * three-point rule: its mean plus two points weighted to match the second through
+ * fourth moments about it, which is exact for rates that are quartic in that quantity.
+ * Aging models are mostly products of factors that each depend on few quantities, so
+ * these effects are combined multiplicatively; the difference from combining them
+ * additively estimates how much interactions between quantities could change the rate
+ * and counts towards the error of the range.
+ */
+vector<MTTFSegment>
+Unit::mttfs(const Trace& data, const shared_ptr<FailureMechanism>& mechanism, AggregationStatistics& stats) const
+{
+    static const int min_depth = 3;
+
+    stats.segments += data.size();
+    if (tolerance <= 0 || data.size() <= 2)
+    {
+        vector<MTTFSegment> pieces(data.size());
+        for (size_t j = 0; j < data.size(); j++)
+            pieces[j] = {data.length(j), mechanism->timeToFailure(data[j], min(activity(data[j], mechanism), 1.0))};
+        stats.evaluations += data.size();
+        return pieces;
+    }
+
+    vector<double> duty_cycles(data.size());
+    for (size_t j = 0; j < data.size(); j++)
+        duty_cycles[j] = min(activity(data[j], mechanism), 1.0);
+
+    // Prefix sums of the length-weighted first four powers of each quantity (and of the
+    // duty cycle, which is last) so the moments over any range of segments can be found
+    // in constant time.  Values are taken relative to their first row to limit rounding.
+    vector<string> quantities = data.quantities();
+    size_t n = quantities.size();
+    auto value = [&](size_t q, size_t j){ return q < n ? data.value(quantities[q], j) : duty_cycles[j]; };
+    vector<double> lengths(data.size() + 1, 0), offsets(n + 1);
+    vector<vector<array<double, 4>>> sums(n + 1, vector<array<double, 4>>(data.size() + 1, {0, 0, 0, 0}));
+    for (size_t q = 0; q <= n; q++)
+        offsets[q] = value(q, 0);
+    for (size_t j = 0; j < data.size(); j++)
+    {
+        lengths[j + 1] = lengths[j] + data.length(j);
+        for (size_t q = 0; q <= n; q++)
+        {
+            double x = value(q, j) - offsets[q], power = data.length(j);
+            for (size_t k = 0; k < 4; k++)
+                sums[q][j + 1][k] = sums[q][j][k] + (power *= x);
+        }
+    }
+
+    struct Estimate
+    {
+        MTTFSegment piece;
+        double rate;
+        double uncertainty;
+        bool exact;
+    };
+    auto rate = [&](const unordered_map<string, double>& point, double duty_cycle) {
+        stats.evaluations++;
+        Trace t(point);
+        return 1/mechanism->timeToFailure(t[0], min(max(duty_cycle, 0.0), 1.0));
+    };
+    auto evaluate = [&](size_t begin, size_t end) -> Estimate {
+        // Ranges that are no longer than the number of points the rule below would take
+        // are cheaper to evaluate segment by segment
+        double length = lengths[end] - lengths[begin];
+        if (end - begin <= 2*n + 3)
+        {
+            double total = 0;
+            for (size_t j = begin; j < end; j++)
+                total += data.length(j)/mechanism->timeToFailure(data[j], duty_cycles[j]);
+            stats.evaluations += end - begin;
+            return {{length, length/total}, total, 0, true};
+        }
+
+        vector<double> means(n + 1);
+        vector<array<double, 4>> rules(n + 1, {0, 0, 0, 0}); // Points and their weights
+        unordered_map<string, double> point;
+        for (size_t q = 0; q <= n; q++)
+        {
+            array<double, 4> m;
+            for (size_t k = 0; k < 4; k++)
+                m[k] = (sums[q][end][k] - sums[q][begin][k])/length;
+            double second = m[1] - m[0]*m[0];
+            double third = m[2] - 3*m[0]*m[1] + 2*pow(m[0], 3);
+            double fourth = m[3] - 4*m[0]*m[2] + 6*m[0]*m[0]*m[1] - 3*pow(m[0], 4);
+            means[q] = m[0] + offsets[q];
+            if (second > 1e-12*max(means[q]*means[q], 1e-12) && fourth*second > third*third)
+            {
+                // The points are the roots of x^2 - sum*x + product about the mean
+                double sum = third/second, product = (third*sum - fourth)/second;
+                double root = sqrt(sum*sum - 4*product);
+                double above = (sum + root)/2, below = (sum - root)/2;
+                rules[q] = {means[q] + above, means[q] + below,
+                            second/(above*(above - below)), second/(below*(below - above))};
+            }
+            if (q < n)
+                point[quantities[q]] = means[q];
+        }
+
+        double center = rate(point, means[n]), product = 1, sum = 1;
+        for (size_t q = 0; q <= n; q++)
+        {
+            if (rules[q][2] == 0 && rules[q][3] == 0)
+                continue;
+            double above, below;
+            if (q < n)
+            {
+                unordered_map<string, double> shifted = point;
+                shifted[quantities[q]] = rules[q][0];
+                above = rate(shifted, means[n]);
+                shifted[quantities[q]] = rules[q][1];
+                below = rate(shifted, means[n]);
+            }
+            else
+            {
+                above = rate(point, rules[n][0]);
+                below = rate(point, rules[n][1]);
+            }
+            double effect = (rules[q][2]*(above - center) + rules[q][3]*(below - center))/center;
+            product *= 1 + effect;
+            sum += effect;
+        }
+        return {{length, 1/(center*product)}, length*center*product, length*center*abs(product - sum), false};
+    };
+
+    vector<MTTFSegment> pieces;
+    double error = 0, total = 0;
+    function<void(size_t, size_t, const Estimate&, int)> refine;
+    refine = [&](size_t begin, size_t end, const Estimate& whole, int depth) {
+        if (whole.exact)
+        {
+            pieces.push_back(whole.piece);
+            total += whole.rate;
+            return;
+        }
+        size_t middle = begin + (end - begin)/2;
+        Estimate left = evaluate(begin, middle), right = evaluate(middle, end);
+        double fine = left.rate + right.rate;
+        double difference = abs(whole.rate - fine) + left.uncertainty + right.uncertainty;
+        if (depth >= min_depth && difference <= tolerance*fine)
+        {
+            pieces.push_back(left.piece);
+            pieces.push_back(right.piece);
+            error += difference;
+            total += fine;
+        }
+        else
+        {
+            refine(begin, middle, left, depth + 1);
+            refine(middle, end, right, depth + 1);
+        }
+    };
+    refine(0, data.size(), evaluate(0, data.size()), 0);
+
+    if (total > 0)
+        stats.error = max(stats.error, error/total);
+    return pieces;
+}
+
+/**
+ * Compute the reliability function of a trace for a failure mechanism from the MTTFs of
+ * its pieces (see Unit::mttfs).  With Trace::single_precision, and when each segment is
+ * a piece, the pieces are stored in single precision, which they are already limited to
+ * by the trace's values.
+ */
+WeibullDistribution
+Unit::trace_distribution(const Trace& data, const shared_ptr<FailureMechanism>& mechanism, AggregationStatistics& stats) const
+{
+    if (!Trace::single_precision || tolerance > 0)
+        return mechanism->distribution(mttfs(data, mechanism, stats));
+
+    vector<CompactMTTFSegment> pieces(data.size());
+    for (size_t j = 0; j < data.size(); j++)
+        pieces[j] = {(float)data.length(j), (float)mechanism->timeToFailure(data[j], min(activity(data[j], mechanism), 1.0))};
+    stats.segments += data.size();
+    stats.evaluations += data.size();
+    return mechanism->distribution(pieces);
+}
+
+/**
+ * Combine the MTTFs of each failure mechanism over a trace into overall MTTFs over
+ * the stretches of the trace in which none of them change, in the same way as their
+ * reliability functions are combined.
+ */
+static vector<MTTFSegment>
+combine(const vector<pair<shared_ptr<FailureMechanism>, vector<MTTFSegment>>>& mttfs)
+{
+    vector<MTTFSegment> combined;
+    vector<size_t> indices(mttfs.size(), 0);
+    vector<double> ends(mttfs.size(), numeric_limits<double>::infinity());
+    for (size_t i = 0; i < mttfs.size(); i++)
+        if (!mttfs[i].second.empty())
+            ends[i] = mttfs[i].second[0].duration;
+    for (double start = 0, end; isfinite(end = *min_element(ends.begin(), ends.end())); start = end)
+    {
+        WeibullDistribution overall;
+        for (size_t i = 0; i < mttfs.size(); i++)
+        {
+            const MTTFSegment& piece = mttfs[i].second[min(indices[i], mttfs[i].second.size() - 1)];
+            WeibullDistribution distribution = mttfs[i].first->distribution(vector<MTTFSegment>{{piece.duration, piece.mttf}});
+            overall = i == 0 ? distribution : overall*distribution;
+        }
+        combined.push_back({end - start, overall.rate()});
+
+        // Move past every piece that ends here, allowing for rounding in the ends
+        for (size_t i = 0; i < mttfs.size(); i++)
+        {
+            if (ends[i] > end*(1 + 1e-12) || indices[i] >= mttfs[i].second.size())
+                continue;
+            if (++indices[i] < mttfs[i].second.size())
+                ends[i] += mttfs[i].second[indices[i]].duration;
+            else
+                ends[i] = numeric_limits<double>::infinity();
+        }
+    }
+    return combined;
+}
+
+// Guards ReliabilityCaches, which Units can fill from several threads at once
+static mutex cache_lock;
+
 /**
  * Compute the reliability functions, R(t), for this Unit for all configurations.
+ * If they have already been computed for a Unit this one is a replica of, they
+ * aren't computed again, and results for traces that have already been evaluated
+ * by another Unit of the same type are taken from the cache.  Each phase of a
+ * profile is reduced to its rate once, and since rates are duration-weighted
+ * averages, the phases are then combined as if each were a single segment.  If rows
+ * have been streamed to this Unit, they take the place of its fresh trace.  Returns
+ * how much work was done and, if trace segments were aggregated, how much error that
+ * added.
+ *
+ * With Unit::piecewise, each profile whose phases have repeat counts (so they run for
+ * definite amounts of time) also gets an AgingSchedule from the combined MTTF of each
+ * stretch of its traces, and its overall reliability function is the average of
+ * those instead of the combination of each mechanism's average, so that the two agree.
+ * That takes every mechanism having the same Weibull shape; if they don't, the Unit
+ * ages at its average rate with a warning.
+ * The segments of a trace aren't cached, so they are evaluated for every Unit.
  */
-void
-Unit::compute_reliability(const set<shared_ptr<FailureMechanism>>& mechanisms)
+AggregationStatistics
+Unit::compute_reliability(const set<shared_ptr<FailureMechanism>>& mechanisms, ReliabilityCache& cache)
 {
-    for (const auto& trace: traces)
+    AggregationStatistics stats;
+    lock_guard<mutex> guard(distributions->lock); // Replicas share distributions
+    if (!distributions->overall.empty())
+        return stats;
+
+    for (const auto& profile: profiles)
     {
+        auto& reliabilities = distributions->mechanisms[profile.first];
+        bool timed = piecewise && !(profile.first == fresh && !streamed.empty())
+                  && all_of(profile.second.begin(), profile.second.end(), [](const Phase& p){ return p.repeat > 0; });
+        vector<vector<pair<shared_ptr<FailureMechanism>, vector<MTTFSegment>>>> segments(timed ? profile.second.size() : 0);
         for (const shared_ptr<FailureMechanism>& mechanism: mechanisms)
         {
-            vector<MTTFSegment> mttfs(trace.second.size());
-            for (size_t j = 0; j < trace.second.size(); j++)
+            if (profile.first == fresh && !streamed.empty())
             {
-                double duty_cycle = min(activity(trace.second[j], mechanism), 1.0);
-                double dt = j > 0 ? trace.second[j].time - trace.second[j - 1].time : trace.second[j].time;
-                mttfs[j] = {dt, mechanism->timeToFailure(trace.second[j], duty_cycle)};
+                reliabilities[mechanism] = streamed_distribution(mechanism);
+                continue;
             }
-            reliabilities[trace.first][mechanism] = mechanism->distribution(mttfs);
+
+            vector<MTTFSegment> phases;
+            for (size_t i = 0; i < profile.second.size(); i++)
+            {
+                const Phase& phase = profile.second[i];
+                ReliabilityCache::key_type key(typeid(*this), phase.trace.get(), mechanism);
+                const WeibullDistribution* cached = nullptr;
+                {
+                    lock_guard<mutex> guard(cache_lock);
+                    auto entry = cache.find(key);
+                    if (entry != cache.end())
+                        cached = &entry->second;
+                }
+                if (timed)
+                    segments[i].emplace_back(mechanism, mttfs(*phase.trace, mechanism, stats));
+                if (!cached)
+                {
+                    WeibullDistribution computed = timed ? mechanism->distribution(segments[i].back().second)
+                                                         : trace_distribution(*phase.trace, mechanism, stats);
+                    lock_guard<mutex> guard(cache_lock);
+                    cached = &cache.emplace(key, computed).first->second;
+                }
+                if (profile.second.size() == 1)
+                    reliabilities[mechanism] = *cached;
+                phases.push_back({phase.duration, cached->rate()});
+            }
+            if (profile.second.size() > 1)
+                reliabilities[mechanism] = mechanism->distribution(phases);
+        }
+        WeibullDistribution& overall = distributions->overall[profile.first];
+        overall = reliabilities.begin()->second;
+        for (auto it = next(reliabilities.begin()); it != reliabilities.end(); ++it)
+            overall *= it->second;
+
+        // Pieces can only be combined into one Weibull distribution if every mechanism
+        // has the same shape
+        double beta = reliabilities.begin()->second.shape();
+        if (timed && any_of(reliabilities.begin(), reliabilities.end(), [&](const pair<const shared_ptr<FailureMechanism>, WeibullDistribution>& r){
+                return r.second.shape() != beta;
+            }))
+        {
+            WARN("%s: aging mechanisms have different Weibull shapes, so it ages at its average rate instead of piecewise\n", name.c_str());
+            timed = false;
+        }
+        if (timed)
+        {
+            vector<MTTFPhase> phases;
+            vector<MTTFSegment> pieces;
+            for (size_t i = 0; i < profile.second.size(); i++)
+            {
+                phases.push_back({combine(segments[i]), profile.second[i].repeat});
+                for (const MTTFSegment& piece: phases.back().segments)
+                    pieces.push_back({piece.duration*phases.back().repeat, piece.mttf});
+            }
+            AgingSchedule schedule(phases);
+            if (!schedule.uniform())
+            {
+                overall = reliabilities.begin()->first->distribution(pieces);
+                distributions->schedules[profile.first] = move(schedule);
+            }
+        }
+    }
+    return stats;
+}
+
+/**
+ * Replace a quantity with a constant value in all of this Unit's traces (e.g. to ask
+ * what happens if it always runs at a different voltage).  The Unit gets its own
+ * copies of the traces and stops sharing reliability functions with the Unit it was
+ * replicated from.
+ */
+void
+Unit::override(const string& quantity, double value)
+{
+    for (auto& profile: profiles)
+    {
+        for (Phase& phase: profile.second)
+        {
+            shared_ptr<Trace> trace = make_shared<Trace>(*phase.trace);
+            trace->set(quantity, value);
+            phase.trace = trace;
         }
-        overall_reliabilities[trace.first] = reliabilities[trace.first].begin()->second;
-        for (auto it = next(reliabilities[trace.first].begin()); it != reliabilities[trace.first].end(); ++it)
-            overall_reliabilities[trace.first] *= it->second;
     }
+    distributions = make_shared<Distributions>();
+}
+
+/**
+ * Add a row of trace data for the fresh configuration that arrived while it was being
+ * produced (see TraceStream).  Each failure mechanism's MTTF for the row is folded
+ * into running totals, so rows aren't kept, and the totals take the place of the
+ * Unit's fresh trace when its reliability is computed.  Quantities missing from the
+ * row take the Unit's default values, and frequencies are converted from MHz to Hz as
+ * for trace files.
+ */
+void
+Unit::stream(double time, const unordered_map<string, double>& values, const set<shared_ptr<FailureMechanism>>& mechanisms)
+{
+    if (time <= streamed_time)
+    {
+        WARN("ignoring streamed row for %s at time %g, which is not after its previous row\n", name.c_str(), time);
+        return;
+    }
+    if (streamed.empty()) // Stop sharing results with the Unit this one was replicated from
+        distributions = make_shared<Distributions>();
+
+    unordered_map<string, double> point = defaults;
+    for (const auto& value: values)
+        point[value.first] = value.second;
+    Trace row(point, time, time - streamed_time);
+    row.scale("frequency", 1e6);
+    for (const shared_ptr<FailureMechanism>& mechanism: mechanisms)
+    {
+        double mttf = mechanism->timeToFailure(row[0], min(activity(row[0], mechanism), 1.0));
+        Accumulated& totals = streamed[mechanism];
+        totals.duration += row.length(0);
+        totals.damage += row.length(0)/mttf;
+    }
+    streamed_time = time;
+}
+
+/**
+ * Get the reliability function for a failure mechanism from the rows streamed to this
+ * Unit so far.
+ */
+WeibullDistribution
+Unit::streamed_distribution(const shared_ptr<FailureMechanism>& mechanism) const
+{
+    const Accumulated& totals = streamed.at(mechanism);
+    return mechanism->distribution(vector<MTTFSegment>{{totals.duration, totals.duration/totals.damage}});
+}
+
+/**
+ * Estimate this Unit's overall aging rate from the rows streamed to it so far, or 0
+ * if there haven't been any.
+ */
+double
+Unit::streamed_rate() const
+{
+    if (streamed.empty())
+        return 0;
+    WeibullDistribution overall = streamed_distribution(streamed.begin()->first);
+    for (auto it = next(streamed.begin()); it != streamed.end(); ++it)
+        overall *= streamed_distribution(it->first);
+    return overall.rate();
 }
 
 /**
@@ -315,7 +887,7 @@ Unit::aging_rate(const config_t& c) const
     if (failed_in_trace(c))
         return 0;
     else
-        return overall_reliabilities.at(c).rate();
+        return distributions->overall.at(c).rate();
 }
 
 /**
@@ -325,7 +897,20 @@ Unit::aging_rate(const config_t& c) const
 double
 Unit::aging_rate(const std::shared_ptr<FailureMechanism>& mechanism) const
 {
-    return reliabilities.at(fresh).at(mechanism).rate();
+    return distributions->mechanisms.at(fresh).at(mechanism).rate();
+}
+
+/**
+ * Compute this Unit's cumulative hazard -ln(R(t)) at time t assuming a fresh system,
+ * which is its actual cumulative hazard if it's invariant (see Unit::invariant).
+ */
+double
+Unit::cumulative_hazard(double t) const
+{
+    auto schedule = distributions->schedules.find(fresh);
+    if (schedule != distributions->schedules.end())
+        t = schedule->second.age(t);
+    return distributions->overall.at(fresh).cumulative_hazard(t);
 }
 
 /**
@@ -334,7 +919,7 @@ Unit::aging_rate(const std::shared_ptr<FailureMechanism>& mechanism) const
 double
 Unit::reliability(const config_t& c, double t) const
 {
-    return overall_reliabilities.at(c)(t);
+    return distributions->overall.at(c)(t);
 }
 
 /**
@@ -344,7 +929,7 @@ Unit::reliability(const config_t& c, double t) const
 double
 Unit::inverse(const config_t& c, double r) const
 {
-    return overall_reliabilities.at(c).inverse(r);
+    return distributions->overall.at(c).inverse(r);
 }
 
 /**
@@ -356,22 +941,121 @@ Unit::failed_in_trace(const config_t& c) const
     return c.count(name) > 0;
 }
 
+/**
+ * Check if any of this Unit's traces is for a configuration in which the component
+ * with the given name has failed.
+ */
+bool
+Unit::references(const string& n) const
+{
+    for (const auto& profile: profiles)
+        if (profile.first.count(n) > 0)
+            return true;
+    return false;
+}
+
+/**
+ * Check if this Unit and another one can be exchanged for each other without changing
+ * the outcome of simulation, which means they are the same type of Unit, have the same
+ * traces for the same configurations, and have no redundant copies.  Units with
+ * streamed data are never exchangeable.
+ */
+bool
+Unit::exchangeable(const Unit& other) const
+{
+    if (typeid(*this) != typeid(other) || copies != 1 || other.copies != 1 || profiles.size() != other.profiles.size())
+        return false;
+    if (!streamed.empty() || !other.streamed.empty())
+        return false;
+    for (const auto& profile: profiles)
+    {
+        auto match = other.profiles.find(profile.first);
+        if (match == other.profiles.end() || match->second.size() != profile.second.size())
+            return false;
+        for (size_t i = 0; i < profile.second.size(); i++)
+        {
+            const Phase& a = profile.second[i];
+            const Phase& b = match->second[i];
+            if (a.duration != b.duration || a.repeat != b.repeat || (a.trace != b.trace && !(*a.trace == *b.trace)))
+                return false;
+        }
+    }
+    return true;
+}
+
 /**
  * Set this Unit as having failed.  If there is redundancy, the amount of available
  * redudant units is decremented instead, and this Unit only fails if there are none
- * left.  If the type of redundancy is serial, then this Unit's age and reliability
- * are reset.
+ * left.  Returns true if the Unit is replaced by a fresh copy, which happens when the
+ * type of redundancy is serial and there is a copy left, meaning its age and
+ * reliability should be reset.
  */
-void
+bool
 Unit::failure()
 {
     _failed = --remaining == 0;
-    if (serial)
+    return serial && !_failed;
+}
+
+/**
+ * Count a failure of this Unit at time t as caused by the mth failure mechanism it's
+ * simulated with.
+ */
+void
+Unit::attribute(size_t m, double t)
+{
+    if (m >= causes.size())
     {
-        _current_reliability = 1;
-        age = 0;
-        prev_config = {};
+        causes.resize(m + 1, 0);
+        cause_sums.resize(m + 1, 0);
     }
+    causes[m]++;
+    cause_sums[m] += t;
+}
+
+/**
+ * Get the mean time of the failures of this Unit attributed to the mth failure
+ * mechanism it's simulated with.
+ */
+double
+Unit::attributed_mttf(size_t m) const
+{
+    if (attributed(m) == 0)
+        return numeric_limits<double>::quiet_NaN();
+    else
+        return cause_sums[m]/causes[m];
+}
+
+/**
+ * Add the failures recorded by another copy of this Unit to this one's, including
+ * which failure mechanisms they were attributed to.
+ */
+void
+Unit::merge(const Component& other)
+{
+    Component::merge(other);
+    const Unit& unit = dynamic_cast<const Unit&>(other);
+    if (unit.causes.size() > causes.size())
+    {
+        causes.resize(unit.causes.size(), 0);
+        cause_sums.resize(unit.causes.size(), 0);
+    }
+    for (size_t m = 0; m < unit.causes.size(); m++)
+    {
+        causes[m] += unit.causes[m];
+        cause_sums[m] += unit.cause_sums[m];
+    }
+}
+
+/**
+ * Forget all recorded failures and their causes.
+ */
+void
+Unit::clear()
+{
+    Component::clear();
+    causes.clear();
+    cause_sums.clear();
 }
 
 /**
@@ -391,7 +1075,7 @@ Unit::dump(ostream& stream) const
 double
 Core::activity(const DataPoint& data, const shared_ptr<FailureMechanism>&) const
 {
-    return data.data.at("power")/data.data.at("peak_power");
+    return data.at("power")/data.at("peak_power");
 }
 
 /**
@@ -409,7 +1093,7 @@ Core::activity(const DataPoint& data, const shared_ptr<FailureMechanism>&) const
 double
 Logic::activity(const DataPoint& data, const shared_ptr<FailureMechanism>& mechanism) const
 {
-    double duty_cycle = min(data.data.at("activity")/(data.duration*data.data.at("frequency")), 1.0);
+    double duty_cycle = min(data.at("activity")/(data.duration*data.at("frequency")), 1.0);
     if (mechanism->name == "NBTI")
         return 1 - duty_cycle*duty_cycle/2;
     else
@@ -432,10 +1116,12 @@ Memory::activity(const DataPoint& data, const shared_ptr<FailureMechanism>& mech
 
 /**
  * Constructor for a group of components.  Has a set of children that can either be other Groups
- * or Units, and is considered to be failed if enough of its children have failed.
+ * or Units, and is considered to be failed if enough of its children have failed.  A <unit>
+ * child with a count attribute refers to that many replicas of a unit (see replica_name).
  */
 Group::Group(const xml_node& node, vector<shared_ptr<Unit>>& units)
-    : Component(node.attribute("name").value()), failures(node.attribute("failures").as_int())
+    : Component(node.attribute("name").value()), failures(node.attribute("failures").as_int()),
+      collapsed(false), _failed(false)
 {
     for (const xml_node& child: node.children())
     {
@@ -443,11 +1129,19 @@ Group::Group(const xml_node& node, vector<shared_ptr<Unit>>& units)
             _children.push_back(make_shared<Group>(child, units));
         else if (strcmp(child.name(), "unit") == 0)
         {
-            string n = child.attribute("name").value();
-            auto unit = find_if(units.begin(), units.end(),
-                                [&](const shared_ptr<Unit>& u){ return u->name == n; });
-            if (unit != units.end())
-                _children.push_back(*unit);
+            vector<string> names;
+            if (child.attribute("count"))
+                for (int i = 0; i < child.attribute("count").as_int(); i++)
+                    names.push_back(replica_name(child.attribute("name").value(), i));
+            else
+                names.push_back(child.attribute("name").value());
+            for (const string& n: names)
+            {
+                auto unit = find_if(units.begin(), units.end(),
+                                    [&](const shared_ptr<Unit>& u){ return u->name == n; });
+                if (unit != units.end())
+                    _children.push_back(*unit);
+            }
         }
         else
         {
@@ -464,6 +1158,8 @@ Group::Group(const xml_node& node, vector<shared_ptr<Unit>>& units)
 bool
 Group::failed() const
 {
+    if (collapsed)
+        return _failed;
     unsigned int f = 0;
     for (const shared_ptr<Component>& child: _children)
         if (child->failed() && ++f > failures)
@@ -471,6 +1167,278 @@ Group::failed() const
     return false;
 }
 
+/**
+ * Compute this Group's cumulative hazard -ln(R(t)) at time t from its children's
+ * assuming a fresh system.  The group survives if at most k = failures of its n
+ * children have failed, which is the standard O(nk) dynamic program over the number
+ * of failed children.  The probability that more than k have failed is accumulated
+ * separately so that the result is accurate when it is small.
+ */
+double
+Group::cumulative_hazard(double t) const
+{
+    const vector<shared_ptr<Component>>& c = members();
+    size_t k = min<size_t>(failures, c.size());
+    vector<double> p(k + 1, 0); // p[j] is the probability that exactly j have failed so far
+    p[0] = 1;
+    double lost = 0;
+    for (const shared_ptr<Component>& child: c)
+    {
+        double h = child->cumulative_hazard(t);
+        double r = exp(-h), q = -expm1(-h);
+        lost += p[k]*q;
+        for (size_t j = k; j > 0; j--)
+            p[j] = p[j]*r + p[j - 1]*q;
+        p[0] *= r;
+    }
+    double r = accumulate(p.begin(), p.end(), 0.0);
+    return r < 0.5 ? -log(r) : -log1p(-lost);
+}
+
+/**
+ * Hide this Group's children from the failure dependency graph, after which it only
+ * fails when Group::failure is called.
+ */
+void
+Group::collapse()
+{
+    parts.swap(_children);
+    collapsed = true;
+}
+
+/**
+ * Fail the given groups that can no longer be reached from the root of the failure
+ * dependency graph without passing through a failed component, as in
+ * Unit::parents_failed, and return them.
+ */
+vector<shared_ptr<Group>>
+Group::parents_failed(const shared_ptr<Component>& root, const vector<shared_ptr<Group>>& groups)
+{
+    vector<shared_ptr<Group>> failed;
+    if (groups.empty())
+        return failed;
+    unordered_set<shared_ptr<Component>> reached;
+    Component::conditional_walk(root, [&](const shared_ptr<Component>& c){
+        if (c->failed())
+            return false;
+        reached.insert(c);
+        return true;
+    });
+    for (const shared_ptr<Group>& group: groups)
+    {
+        if (reached.count(group) == 0)
+        {
+            group->_failed = true;
+            failed.push_back(group);
+        }
+    }
+    return failed;
+}
+
+/**
+ * Build the table by enumerating the configurations the system can reach before it
+ * fails, exploring every order in which its units and collapsed groups can fail
+ * starting from a fresh system, and resolving the trace each healthy unit uses in
+ * each of them.  At most cap sets of failed components are explored; if there are
+ * more than that, the remaining configurations are resolved during simulation.
+ */
+ConfigurationTable::ConfigurationTable(const shared_ptr<Component>& root, const vector<shared_ptr<Unit>>& units,
+                                       const vector<shared_ptr<Group>>& groups, size_t cap)
+{
+    size_t n = units.size() + groups.size();
+    auto set_failed = [&](const vector<bool>& state){
+        for (size_t i = 0; i < units.size(); i++)
+            units[i]->_failed = state[i];
+        for (size_t i = 0; i < groups.size(); i++)
+            groups[i]->_failed = state[units.size() + i];
+    };
+
+    set<vector<bool>> visited;
+    queue<vector<bool>> states;
+    bool truncated = false;
+    states.push(vector<bool>(n, false));
+    visited.insert(states.front());
+    while (!states.empty())
+    {
+        vector<bool> state = states.front();
+        states.pop();
+        set_failed(state);
+        if (root->failed())
+            continue;
+
+        Unit::config_t config = Unit::configuration(root);
+        auto entry = ids.emplace(config, ids.size());
+        size_t id = entry.first->second;
+        for (size_t i = 0; i < units.size(); i++)
+        {
+            if (state[i])
+                continue;
+            vector<const Unit::config_t*>& resolved = units[i]->resolved;
+            if (resolved.size() <= id)
+                resolved.resize(id + 1, nullptr);
+            if (resolved[id])
+                continue;
+            resolved[id] = units[i]->resolve(config);
+            if (*resolved[id] != config)
+                WARN("can't find configuration %s for %s; using configuration %s\n", str(config).c_str(), units[i]->name.c_str(), str(*resolved[id]).c_str());
+        }
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (state[i])
+                continue;
+            if (visited.size() >= cap)
+            {
+                truncated = true;
+                break;
+            }
+            set_failed(state);
+            if (i < units.size())
+                units[i]->_failed = true;
+            else
+                groups[i - units.size()]->_failed = true;
+            Unit::parents_failed(root, units);
+            Group::parents_failed(root, groups);
+            vector<bool> next(n);
+            for (size_t j = 0; j < units.size(); j++)
+                next[j] = units[j]->_failed;
+            for (size_t j = 0; j < groups.size(); j++)
+                next[units.size() + j] = groups[j]->_failed;
+            if (visited.insert(next).second)
+                states.push(next);
+        }
+    }
+    set_failed(vector<bool>(n, false));
+    if (truncated)
+        WARN("stopped exploring configurations after %zu sets of failed units; remaining ones will be resolved during simulation\n", cap);
+}
+
+/**
+ * Get the index of a configuration, or ConfigurationTable::npos if it wasn't found
+ * while building the table.
+ */
+size_t
+ConfigurationTable::id(const Unit::config_t& c) const
+{
+    auto entry = ids.find(c);
+    return entry != ids.end() ? entry->second : npos;
+}
+
+/**
+ * Partition units into classes of exchangeable units (see Unit::exchangeable) that
+ * can be simulated together.  Units can only be lumped together if they appear once
+ * each in the failure dependency graph, all with the same parent, and no unit's
+ * traces depend on which of them has failed.  All other units are placed in classes
+ * by themselves.
+ */
+vector<UnitClass>
+UnitClass::lump(const shared_ptr<Component>& root, const vector<shared_ptr<Unit>>& units)
+{
+    unordered_map<shared_ptr<Component>, vector<shared_ptr<Component>>> parents;
+    Component::walk(root, [&](const shared_ptr<Component>& c){
+        for (const shared_ptr<Component>& child: c->children())
+            parents[child].push_back(c);
+    });
+
+    vector<UnitClass> classes;
+    unordered_map<shared_ptr<Component>, vector<size_t>> siblings; // classes under each parent
+    for (const shared_ptr<Unit>& unit: units)
+    {
+        const vector<shared_ptr<Component>>& p = parents[unit];
+        bool lumpable = p.size() == 1 && none_of(units.begin(), units.end(),
+                                                 [&](const shared_ptr<Unit>& u){ return u->references(unit->name); });
+        if (lumpable)
+        {
+            auto match = find_if(siblings[p[0]].begin(), siblings[p[0]].end(),
+                                 [&](size_t i){ return classes[i].representative()->exchangeable(*unit); });
+            if (match != siblings[p[0]].end())
+            {
+                classes[*match].members.push_back(unit);
+                classes[*match]._healthy++;
+                continue;
+            }
+            siblings[p[0]].push_back(classes.size());
+        }
+        classes.emplace_back(unit);
+    }
+    return classes;
+}
+
+/**
+ * Reset all members of this class to being fresh.
+ */
+void
+UnitClass::reset()
+{
+    for (const shared_ptr<Unit>& member: members)
+        member->reset();
+    _healthy = members.size();
+}
+
+/**
+ * Fail a random healthy member of this class.  Returns true if it was replaced by a
+ * fresh copy (see Unit::failure), which only happens in classes of one Unit.
+ */
+bool
+UnitClass::failure(mt19937& gen)
+{
+    uniform_int_distribution<size_t> choice(0, _healthy - 1);
+    size_t i = choice(gen);
+    shared_ptr<Unit> member = members[i];
+    bool renewed = member->failure();
+    if (member->failed())
+    {
+        swap(members[i], members[_healthy - 1]);
+        _healthy--;
+    }
+    return renewed;
+}
+
+/**
+ * Set the first k members of this class as healthy and the rest as failed, without
+ * changing their redundancy (used for exploring states of the system).
+ */
+void
+UnitClass::restore(size_t k)
+{
+    for (size_t i = 0; i < members.size(); i++)
+        members[i]->_failed = i >= k;
+    _healthy = k;
+}
+
+/**
+ * Count the members of this class that haven't failed, including ones that were
+ * failed since the class was last updated.
+ */
+size_t
+UnitClass::surviving() const
+{
+    return count_if(members.begin(), members.end(), [](const shared_ptr<Unit>& m){ return !m->failed(); });
+}
+
+/**
+ * Fail all healthy members of this class because their parent failed (see
+ * Unit::parents_failed).
+ */
+void
+UnitClass::abandon()
+{
+    for (size_t i = 0; i < _healthy; i++)
+        members[i]->_failed = true;
+    _healthy = 0;
+}
+
+/**
+ * Account for members that failed because their parents did (see Unit::parents_failed).
+ * Since members of a class share a parent, they all fail this way together.
+ */
+void
+UnitClass::update()
+{
+    if (_healthy > 0 && representative()->failed())
+        _healthy = 0;
+}
+
 /**
  * Push the string representation of this Group onto a stream, which is its name followed
  * by a list of its children's names and how many failures it can tolerate.
@@ -3,19 +3,26 @@
 #include <bitset>
 #include <cstdint>
 #include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <ostream>
 #include <pugixml.hpp>
+#include <random>
 #include <set>
 #include <stack>
 #include <string>
+#include <tuple>
+#include <typeindex>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "dump.hh"
 #include "failure.hh"
+#include "histogram.hh"
 #include "reliability.hh"
 #include "trace.hh"
 
@@ -50,6 +57,12 @@ namespace oldspot
  */
 class Component
 {
+  private:
+    // Running statistics of this Component's times to failure
+    size_t _failures;
+    double sum;
+    double m2;
+
   public:
     /**
      * Perform a function the given component and each of its children in a
@@ -95,87 +108,247 @@ class Component
         }
     }
 
-    const std::string name;
-    std::vector<double> ttfs;
+    static bool keep;
 
-    Component(const std::string _n) : name(_n) {}
+    const std::string name;
+    std::vector<double> ttfs; // Only kept if Component::keep is set
+    TTFHistogram histogram;
+    TTFDump::Buffer* dump_file;
+    uint32_t channel;         // Index of this Component in the dump
+
+    Component(const std::string _n) : _failures(0), sum(0), m2(0), name(_n), dump_file(nullptr), channel(0) {}
+    void record(double t);
+    virtual void merge(const Component& other);
+    virtual void clear();
+    size_t failures() const { return _failures; }
     virtual std::vector<std::shared_ptr<Component>>& children() = 0;
     virtual double mttf() const;
     virtual double stdttf() const;
     virtual std::pair<double, double> mttf_interval(double confidence=0.95) const;
     virtual double aging_rate() const { return std::numeric_limits<double>::quiet_NaN(); }
+    virtual double cumulative_hazard(double t) const = 0;
     virtual bool failed() const = 0;
 
     virtual std::ostream& dump(std::ostream& stream) const = 0;
     friend std::ostream& operator<<(std::ostream& stream, const Component& c);
 };
 
+class Group;
+
+/**
+ * Reliability functions that have already been computed for a trace by a type of
+ * Unit for a failure mechanism, so Units of the same type with the same trace can
+ * reuse them.
+ */
+typedef std::map<std::tuple<std::type_index, const Trace*, std::shared_ptr<FailureMechanism>>,
+                 WeibullDistribution> ReliabilityCache;
+
+/**
+ * Summary of how much work computing reliability took when adjacent trace segments
+ * are aggregated (see Unit::tolerance).
+ */
+struct AggregationStatistics
+{
+    size_t segments = 0;    // Trace segments that would be evaluated without aggregation
+    size_t evaluations = 0; // Evaluations of failure mechanisms actually performed
+    double error = 0;       // Largest estimated relative error of an aging rate
+};
+
 /**
  * A unit in the system, represented as a leaf node in the failure dependency
  * graph.  Each unit is associated with a trace of power, performance, temperature,
  * etc. that affects the rate at which its reliability degrades.  Each unit requires
  * one of these traces for each healthy configuration of the system except for ones
- * on which the unit has failed.
+ * on which the unit has failed.  Instead of a single trace, a configuration can
+ * have a mission profile consisting of several traces (phases) that the unit spends
+ * different amounts of time running.
  */
 class Unit : public Component
 {
   public:
     typedef std::unordered_set<std::string> config_t;
 
+    /**
+     * Policy for choosing a trace when a unit has none declared for a configuration:
+     * either use the fresh trace or the trace of the largest declared configuration
+     * whose failed units have all failed in the current one.
+     */
+    enum class Fallback { FRESH, SUBSET };
+
   private:
-    double age;
     int copies;
-    double _current_reliability;
     bool _failed;
     int remaining;
     bool serial;
-    config_t config;
-    config_t prev_config;
+
+    /**
+     * Running totals of time and of damage (time divided by MTTF) for a failure
+     * mechanism from rows streamed to this Unit (see Unit::stream).
+     */
+    struct Accumulated
+    {
+        double duration;
+        double damage;
+    };
+
+    std::unordered_map<std::string, double> defaults;
+    std::unordered_map<std::shared_ptr<FailureMechanism>, Accumulated> streamed;
+    double streamed_time;
+
+    // Failures of this Unit attributed to each failure mechanism and the sums of their
+    // times, in the order of the mechanisms it was simulated with (see
+    // Simulation::attribute)
+    std::vector<uint64_t> causes;
+    std::vector<double> cause_sums;
+
+    std::vector<MTTFSegment> mttfs(const Trace& data, const std::shared_ptr<FailureMechanism>& mechanism, AggregationStatistics& stats) const;
+    WeibullDistribution trace_distribution(const Trace& data, const std::shared_ptr<FailureMechanism>& mechanism, AggregationStatistics& stats) const;
 
   protected:
-    std::unordered_map<config_t, std::vector<DataPoint>> traces;
-    std::unordered_map<config_t, std::unordered_map<std::shared_ptr<FailureMechanism>, WeibullDistribution>> reliabilities;
-    std::unordered_map<config_t, WeibullDistribution> overall_reliabilities;
+    typedef std::shared_ptr<const Trace> trace_t;
+
+    /**
+     * Reliability functions for each configuration, both for each failure mechanism
+     * and overall.  Replicas of a Unit share these with it.
+     */
+    struct Distributions
+    {
+        std::mutex lock; // Held while computing them
+        std::unordered_map<config_t, std::unordered_map<std::shared_ptr<FailureMechanism>, WeibullDistribution>> mechanisms;
+        std::unordered_map<config_t, WeibullDistribution> overall;
+        std::unordered_map<config_t, AgingSchedule> schedules; // Non-uniform ones (see Unit::piecewise)
+    };
+
+    /**
+     * Part of a mission profile: a trace, the amount of time spent running it
+     * relative to the other phases, and the number of times it runs in a row if the
+     * profile gives repeat counts rather than weights (0 otherwise).  A single trace is
+     * a profile with one phase that runs once.
+     */
+    struct Phase
+    {
+        trace_t trace;
+        double duration;
+        int repeat;
+    };
+
+    std::unordered_map<config_t, std::vector<Phase>> profiles;
+    std::vector<const config_t*> resolved;
+    std::shared_ptr<Distributions> distributions;
 
   public:
     static char delim;
+    static Fallback fallback;
+    static double tolerance;
+    static bool piecewise;
     static const config_t fresh;
 
     static std::vector<std::shared_ptr<Unit>> parents_failed(const std::shared_ptr<Component>& root, const std::vector<std::shared_ptr<Unit>>& units);
+    static config_t configuration(const std::shared_ptr<Component>& root);
+    static void localize(const std::vector<std::shared_ptr<Unit>>& units);
 
     const unsigned int id;
 
     Unit(const pugi::xml_node& node, unsigned int i, const std::unordered_map<std::string, double>& defaults={});
+    Unit(const Unit& other, const std::string& n, unsigned int i);
+    virtual std::shared_ptr<Unit> replicate(const std::string& n, unsigned int i) const { return std::make_shared<Unit>(*this, n, i); }
     std::vector<std::shared_ptr<Component>>& children() override;
     void reset();
-    void set_configuration(const std::shared_ptr<Component>& root);
-
-    double get_next_event() const;
-    void update_reliability(double dt);
-    double current_reliability() const { return _current_reliability; }
+    const config_t* resolve(const config_t& c) const;
+    const WeibullDistribution& distribution(const config_t& c, size_t i) const;
+    const WeibullDistribution& distribution(const config_t& c, size_t i, const std::shared_ptr<FailureMechanism>& mechanism) const;
+    const AgingSchedule* schedule(const config_t& c, size_t i) const;
 
     virtual double activity(const DataPoint& data, const std::shared_ptr<FailureMechanism>& mechanism) const;
-    void compute_reliability(const std::set<std::shared_ptr<FailureMechanism>>& mechanisms);
+    AggregationStatistics compute_reliability(const std::set<std::shared_ptr<FailureMechanism>>& mechanisms, ReliabilityCache& cache);
+    void override(const std::string& quantity, double value);
+    void stream(double time, const std::unordered_map<std::string, double>& values, const std::set<std::shared_ptr<FailureMechanism>>& mechanisms);
+    WeibullDistribution streamed_distribution(const std::shared_ptr<FailureMechanism>& mechanism) const;
+    double streamed_rate() const;
 
     double aging_rate(const config_t& c) const;
     double aging_rate() const override { return aging_rate(fresh); }
     double aging_rate(const std::shared_ptr<FailureMechanism>& mechanism) const;
+    double cumulative_hazard(double t) const override;
 
     virtual double reliability(const config_t& c, double t) const;
-    double reliability(double t) const { return reliability(config, t); }
-
     virtual double inverse(const config_t& c, double r) const;
-    double inverse(double r) const { return inverse(config, r); }
 
     bool failed_in_trace(const config_t& c) const;
+    bool references(const std::string& n) const;
+    bool exchangeable(const Unit& other) const;
+    bool invariant() const { return copies == 1 && profiles.size() == 1; }
     bool failed() const { return _failed; }
-    void failure();
+    int spares() const { return serial ? remaining - 1 : 0; }
+    bool failure();
+    void abandon() { _failed = true; }
+    void attribute(size_t m, double t);
+    uint64_t attributed(size_t m) const { return m < causes.size() ? causes[m] : 0; }
+    double attributed_mttf(size_t m) const;
+    void merge(const Component& other) override;
+    void clear() override;
 
     virtual std::ostream& dump(std::ostream& stream) const override;
+
+    friend class ConfigurationTable;
+    friend class UnitClass;
 };
 
 std::ostream& operator<<(std::ostream& os, const Unit::config_t& config);
 
+/**
+ * Configurations of failed components that a system can reach before it fails,
+ * each identified by an index.  When the table is built, each Unit determines which
+ * of its traces it uses in each configuration (see Unit::resolve) so that changing
+ * configurations during simulation is a single lookup.
+ */
+class ConfigurationTable
+{
+  private:
+    std::unordered_map<Unit::config_t, size_t> ids;
+
+  public:
+    static constexpr size_t npos = -1;
+
+    ConfigurationTable(const std::shared_ptr<Component>& root, const std::vector<std::shared_ptr<Unit>>& units,
+                       const std::vector<std::shared_ptr<Group>>& groups, size_t cap);
+    size_t size() const { return ids.size(); }
+    size_t id(const Unit::config_t& c) const;
+};
+
+/**
+ * Set of exchangeable Units that are simulated together.  All of the healthy members
+ * of a class have experienced the same configurations for the same amounts of time,
+ * so they share a reliability, which the Simulation tracks for the class as a whole.
+ * The next failure in a class with m healthy members is the first of m independent
+ * failures, and the member that fails is chosen uniformly at random so that results
+ * can still be reported for each member.
+ */
+class UnitClass
+{
+  private:
+    std::vector<std::shared_ptr<Unit>> members;
+    size_t _healthy;
+
+  public:
+    static std::vector<UnitClass> lump(const std::shared_ptr<Component>& root, const std::vector<std::shared_ptr<Unit>>& units);
+
+    UnitClass(const std::shared_ptr<Unit>& unit) : members({unit}), _healthy(1) {}
+    size_t size() const { return members.size(); }
+    size_t healthy() const { return _healthy; }
+    size_t surviving() const;
+    const std::shared_ptr<Unit>& representative() const { return members.front(); }
+    const std::shared_ptr<Unit>& member(size_t i) const { return members[i]; }
+    int copies() const { return members.front()->copies; }  // Only classes of one Unit have more than one
+    bool serial() const { return members.front()->serial; }
+
+    void reset();
+    void restore(size_t k);
+    bool failure(std::mt19937& gen);
+    void abandon();
+    void update();
+};
+
 /**
  * Unit that represents an entire core.  The average activity factor of a core
  * is estimated as its current power consumption divided by its peak power
@@ -186,6 +359,8 @@ class Core : public Unit
   public:
     Core(const pugi::xml_node& node, unsigned int i)
         : Unit(node, i, {{"power", 1}, {"peak_power", 1}}) {}
+    Core(const Core& other, const std::string& n, unsigned int i) : Unit(other, n, i) {}
+    std::shared_ptr<Unit> replicate(const std::string& n, unsigned int i) const override { return std::make_shared<Core>(*this, n, i); }
     double activity(const DataPoint& data, const std::shared_ptr<FailureMechanism>&) const override;
 };
 
@@ -196,6 +371,8 @@ class Logic : public Unit
 {
   public:
     Logic(const pugi::xml_node& node, unsigned int i) : Unit(node, i) {}
+    Logic(const Logic& other, const std::string& n, unsigned int i) : Unit(other, n, i) {}
+    std::shared_ptr<Unit> replicate(const std::string& n, unsigned int i) const override { return std::make_shared<Logic>(*this, n, i); }
     double activity(const DataPoint& data, const std::shared_ptr<FailureMechanism>&) const override;
 };
 
@@ -208,6 +385,8 @@ class Memory : public Unit
 {
   public:
     Memory(const pugi::xml_node& node, unsigned int i) : Unit(node, i) {}
+    Memory(const Memory& other, const std::string& n, unsigned int i) : Unit(other, n, i) {}
+    std::shared_ptr<Unit> replicate(const std::string& n, unsigned int i) const override { return std::make_shared<Memory>(*this, n, i); }
     double activity(const DataPoint& data, const std::shared_ptr<FailureMechanism>& mechanism) const override;
 };
 
@@ -215,18 +394,36 @@ class Memory : public Unit
  * Group component that has children which are either other groups or Units.
  * A group has a threshold that defines how many failures in its children it
  * can tolerate before it itself has failed.
+ *
+ * A group can be collapsed, which hides its children from the rest of the failure
+ * dependency graph so that it can be simulated as if it were a single unit whose
+ * failure is set directly (see Simulation).
  */
 class Group : public Component
 {
   private:
     unsigned int failures;
     std::vector<std::shared_ptr<Component>> _children;
+    std::vector<std::shared_ptr<Component>> parts; // Children of a collapsed group
+    bool collapsed;
+    bool _failed;
 
   public:
+    static std::vector<std::shared_ptr<Group>> parents_failed(const std::shared_ptr<Component>& root, const std::vector<std::shared_ptr<Group>>& groups);
+
     Group(const pugi::xml_node& node, std::vector<std::shared_ptr<Unit>>& units);
     std::vector<std::shared_ptr<Component>>& children() override { return _children; }
+    const std::vector<std::shared_ptr<Component>>& members() const { return collapsed ? parts : _children; }
     bool failed() const;
+    double cumulative_hazard(double t) const override;
+
+    void collapse();
+    void reset() { _failed = false; }
+    void failure() { _failed = true; }
+
     std::ostream& dump(std::ostream& ostream) const override;
+
+    friend class ConfigurationTable;
 };
 
 } // namespace oldspot
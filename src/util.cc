@@ -1,9 +1,13 @@
 #include "util.hh"
 
-#include <cstdio>
+#include <atomic>
 #include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <iterator>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <unordered_set>
@@ -31,7 +35,60 @@ split(const string& str, char delimiter)
     return tokens;
 }
 
-int warn(const char* format, ...)
+/**
+ * Get the name of the ith replica of a component whose name is the given pattern.
+ * The first "%d" in the pattern is replaced with i, or, if there isn't one, i is
+ * appended to the pattern.
+ */
+string
+replica_name(const string& pattern, int i)
+{
+    size_t pos = pattern.find("%d");
+    if (pos == string::npos)
+        return pattern + to_string(i);
+    return pattern.substr(0, pos) + to_string(i) + pattern.substr(pos + 2);
+}
+
+namespace
+{
+
+/**
+ * Bookkeeping shared by all Diagnostics.  It is never destroyed so that it is
+ * still available when the summary is printed at exit.
+ */
+struct Diagnostics
+{
+    mutex lock;
+    vector<const Diagnostic*> sites;
+    unordered_set<string> messages;
+};
+
+Diagnostics* diagnostics = nullptr;
+once_flag diagnostics_created;
+
+}
+
+// Default number of times each call site can issue a warning
+atomic<unsigned int> Diagnostic::limit(10);
+
+/**
+ * Register a new call site for warnings.
+ */
+Diagnostic::Diagnostic(const char* f, int l) : file(f), line(l), occurrences(0), printed(0)
+{
+    call_once(diagnostics_created, [](){
+        diagnostics = new Diagnostics;
+        atexit(summarize);
+    });
+    lock_guard<mutex> guard(diagnostics->lock);
+    diagnostics->sites.push_back(this);
+}
+
+/**
+ * Format and print a warning unless an identical one has already been printed.
+ */
+void
+Diagnostic::emit(const char* format, ...)
 {
     va_list args1;
     va_start(args1, format);
@@ -42,15 +99,29 @@ int warn(const char* format, ...)
     vsnprintf(buf.data(), buf.size(), format, args2);
     va_end(args2);
 
-    static unordered_set<string> warned;
-    string str(buf.begin(), prev(buf.end()));
-    if (warned.count(str) == 0)
+    lock_guard<mutex> guard(diagnostics->lock);
+    if (diagnostics->messages.emplace(buf.begin(), prev(buf.end())).second)
     {
-        warned.insert(str);
-        cerr << "warning: " << str;
+        printed++;
+        cerr << "warning: " << buf.data();
     }
+}
 
-    return str.size();
+/**
+ * Report how many warnings were suppressed from each call site that reached its
+ * limit.
+ */
+void
+Diagnostic::summarize()
+{
+    lock_guard<mutex> guard(diagnostics->lock);
+    for (const Diagnostic* site: diagnostics->sites)
+    {
+        uint64_t suppressed = site->occurrences - site->printed;
+        if (site->occurrences > limit)
+            cerr << "warning: suppressed " << suppressed << " repeated warning(s) from "
+                 << site->file << ':' << site->line << endl;
+    }
 }
 
 }
\ No newline at end of file
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -22,9 +25,68 @@ linterp(const T& x, const std::pair<T, T>& s, const std::pair<T, T>& f)
     return s.second + (f.second - s.second)*(x - s.first)/(f.first - s.first);
 }
 
+// Assumes time is already in seconds
+inline double
+convert_time(double time, const std::string& units)
+{
+    if (units == "seconds")
+        return time;
+    time /= 60;
+    if (units == "minutes")
+        return time;
+    time /= 60;
+    if (units == "hours")
+        return time;
+    time /= 24;
+    if (units == "days")
+        return time;
+    time /= 7;
+    if (units == "weeks")
+        return time;
+    time /= 4;
+    if (units == "months")
+        return time;
+    time /= 12;
+    if (units == "years")
+        return time;
+    throw std::invalid_argument("unknown time unit \"" + units + '"');
+}
+
 std::vector<std::string> split(const std::string& str, char delimiter);
 
-int warn(const char* format, ...);
+std::string replica_name(const std::string& pattern, int i);
+
+/**
+ * A warning issued from one place in the code.  Each call site keeps count of how
+ * many times it has been reached, and after it has been reached Diagnostic::limit
+ * times it is suppressed and its message is no longer formatted or printed.
+ * Identical messages are only printed once, and a summary of suppressed warnings
+ * is printed when the program exits.  Diagnostics can be issued from any thread.
+ * Use the WARN macro rather than creating these directly.
+ */
+class Diagnostic
+{
+  private:
+    const char* const file;
+    const int line;
+    std::atomic<uint64_t> occurrences;
+    std::atomic<uint64_t> printed;
+
+    static void summarize();
+
+  public:
+    static std::atomic<unsigned int> limit;
+
+    Diagnostic(const char* f, int l);
+    bool suppressed() { return occurrences.fetch_add(1, std::memory_order_relaxed) >= limit.load(std::memory_order_relaxed); }
+    void emit(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+#define WARN(...) do { \
+    static ::oldspot::Diagnostic _diagnostic(__FILE__, __LINE__); \
+    if (!_diagnostic.suppressed()) \
+        _diagnostic.emit(__VA_ARGS__); \
+} while (false)
 
 template<typename Rows> void
 writecsv(const std::string& filename, const std::vector<std::shared_ptr<Unit>>& units, Rows&& rows)
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+Check that merging consecutive identical trace rows into one segment doesn't change
+aging rates.  A Logic unit, whose duty cycle is its activity in a row divided by
+the row's duration, is loaded once with a trace of one row and once with a trace of
+the same row repeated, and the two must give the same aging rate for each mechanism
+(to the six significant digits the rates are written with).  The repeated rows must
+also have been merged, so the check covers the merged path.
+
+usage: merging.py [oldspot binary]
+"""
+
+import csv
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+ROWS = 4
+HEADER = "time,activity,vdd,temperature,frequency,power\n"
+ROW = "%d,5e8,1.1,350,1000,1\n"  # Activity of 5e8 cycles at 1000 MHz over 1 s, a duty cycle of 0.5
+
+CONFIG = """<?xml version="1.0" ?>
+<unit type="logic" name="logic">
+    <trace file="%s" failed="" />
+</unit>
+<group name="system" failures="0">
+    <unit name="logic" />
+</group>
+"""
+
+
+def rates(oldspot, directory, rows):
+    """Get the aging rate of the Logic unit for each mechanism given a trace of identical rows."""
+    trace = os.path.join(directory, "logic.trace")
+    with open(trace, "w") as f:
+        f.write(HEADER + "".join(ROW % (i + 1) for i in range(rows)))
+    config = os.path.join(directory, "logic.xml")
+    with open(config, "w") as f:
+        f.write(CONFIG % trace)
+    output = os.path.join(directory, "rates.csv")
+    run = subprocess.run([oldspot, config, "-n", "1", "-v", "--mechanism-aging-rates", output],
+                         check=True, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True)
+    compressed = re.search(r"Compressed (\d+) trace rows into (\d+) segments", run.stdout)
+    with open(output) as f:
+        row = next(csv.DictReader(f))
+    return {k: v for k, v in row.items() if k and " " not in k}, compressed.groups() if compressed else None
+
+
+def main():
+    oldspot = sys.argv[1] if len(sys.argv) > 1 else "./oldspot"
+    with tempfile.TemporaryDirectory() as directory:
+        single, _ = rates(oldspot, directory, 1)
+        merged, compressed = rates(oldspot, directory, ROWS)
+    failures = 0
+    if compressed != (str(ROWS), "1"):
+        print("FAIL %d identical rows were stored as %s segments" % (ROWS, compressed[1] if compressed else "unknown"))
+        failures += 1
+    for mechanism in sorted(single):
+        ok = single[mechanism] == merged[mechanism]
+        failures += not ok
+        print("%s %s: alpha %s from one row vs %s from %d merged rows"
+              % ("ok  " if ok else "FAIL", mechanism, single[mechanism], merged[mechanism], ROWS))
+    if failures:
+        print("%d check(s) failed" % failures)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""
+Check that storing trace values and per-segment MTTFs in single precision
+(--single-precision) changes aging rates by no more than BOUND.  Each example
+configuration is loaded with and without the option, and each unit's aging rate
+(alpha) is compared.
+
+Rounding a value to single precision changes it by at most 2^-24 (6e-8) relative to
+its size, and aging rates depend on temperature and voltage steeply enough to magnify
+that by a few tens, so alphas should differ by a few 1e-6 at most; rates are written
+with six significant digits, which can add up to 1e-5 more.  The bound allows for
+both.
+
+usage: precision.py [oldspot binary] [configuration ...]
+"""
+
+import csv
+import glob
+import os
+import subprocess
+import sys
+import tempfile
+
+BOUND = 2e-5
+
+
+def alphas(oldspot, config, directory, *options):
+    """Get the aging rate of each unit in a configuration."""
+    rates = os.path.join(directory, "rates.csv")
+    subprocess.run([oldspot, config, "-n", "1", "--unit-aging-rates", rates] + list(options),
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    with open(rates) as f:
+        return {row[""]: float(row["alpha"]) for row in csv.DictReader(f)}
+
+
+def main():
+    oldspot = sys.argv[1] if len(sys.argv) > 1 else "./oldspot"
+    configs = sys.argv[2:] or sorted(glob.glob(os.path.join(os.path.dirname(__file__), "..", "example", "*.xml")))
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for config in configs:
+            double = alphas(oldspot, config, directory)
+            single = alphas(oldspot, config, directory, "--single-precision")
+            for unit in sorted(double):
+                difference = abs(single[unit] - double[unit])/double[unit]
+                ok = difference <= BOUND
+                failures += not ok
+                print("%s %s %s: alpha %g vs %g (relative difference %.3g)"
+                      % ("ok  " if ok else "FAIL", os.path.basename(config), unit, double[unit], single[unit], difference))
+    if failures:
+        print("%d unit(s) differ by more than %g" % (failures, BOUND))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
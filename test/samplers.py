@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+"""
+Check that the unit and competing-risk samplers (--sampler unit and --sampler
+competing) simulate the same lifetimes.  Each example configuration is simulated
+with both samplers from fixed seeds, and for the system and each unit the test
+compares:
+
+ - the times to failure with a two-sample Kolmogorov-Smirnov test, and
+ - the fraction of iterations in which the unit failed with a two-proportion z-test.
+
+A comparison fails if its p-value is below ALPHA.  The seeds are fixed, so a build
+either always passes or always fails.
+
+usage: samplers.py [oldspot binary] [configuration ...]
+"""
+
+import glob
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+ITERATIONS = 5000
+SEEDS = {"unit": 1, "competing": 2}
+ALPHA = 0.001
+
+
+def simulate(oldspot, config, sampler, directory):
+    """Simulate a configuration with a sampler and return each component's TTFs."""
+    dump = os.path.join(directory, sampler + ".csv")
+    subprocess.run([oldspot, config, "-n", str(ITERATIONS), "--seed", str(SEEDS[sampler]),
+                    "--sampler", sampler, "--dump-ttfs", dump],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    ttfs = {}
+    with open(dump) as f:
+        for line in f:
+            fields = line.strip().split(",")
+            ttfs[fields[0]] = sorted(float(x) for x in fields[1:] if x)
+    return ttfs
+
+
+def ks(a, b):
+    """Two-sample Kolmogorov-Smirnov statistic and its asymptotic p-value."""
+    i = j = 0
+    d = 0.0
+    while i < len(a) and j < len(b):
+        if a[i] <= b[j]:
+            i += 1
+        else:
+            j += 1
+        d = max(d, abs(i/len(a) - j/len(b)))
+    en = math.sqrt(len(a)*len(b)/(len(a) + len(b)))
+    lam = (en + 0.12 + 0.11/en)*d
+    p = 2*sum((-1)**(k - 1)*math.exp(-2*k*k*lam*lam) for k in range(1, 101))
+    return d, min(max(p, 0.0), 1.0)
+
+
+def proportions(x, y, n):
+    """Two-proportion z statistic for x and y successes out of n each and its p-value."""
+    pooled = (x + y)/(2*n)
+    if pooled in (0, 1):
+        return 0.0, 1.0
+    z = (x - y)/n/math.sqrt(2*pooled*(1 - pooled)/n)
+    return z, math.erfc(abs(z)/math.sqrt(2))
+
+
+def main():
+    oldspot = sys.argv[1] if len(sys.argv) > 1 else "./oldspot"
+    configs = sys.argv[2:] or sorted(glob.glob(os.path.join(os.path.dirname(__file__), "..", "example", "*.xml")))
+    failures = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for config in configs:
+            unit = simulate(oldspot, config, "unit", directory)
+            competing = simulate(oldspot, config, "competing", directory)
+            for name in sorted(set(unit) | set(competing)):
+                a, b = unit.get(name, []), competing.get(name, [])
+                z, pz = proportions(len(a), len(b), ITERATIONS)
+                d, pd = ks(a, b) if a and b else (float("nan"), 1.0)
+                ok = pz >= ALPHA and pd >= ALPHA
+                failures += not ok
+                print("%s %s %s: failed %d vs %d times (p=%.3g), KS D=%.4f (p=%.3g)"
+                      % ("ok  " if ok else "FAIL", os.path.basename(config), name, len(a), len(b), pz, d, pd))
+    if failures:
+        print("%d comparison(s) failed" % failures)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
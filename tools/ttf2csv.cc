@@ -0,0 +1,73 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <tclap/CmdLine.h>
+#include <vector>
+
+#include "dump.hh"
+#include "util.hh"
+
+using namespace oldspot;
+using namespace std;
+
+/**
+ * Convert a binary time-to-failure dump (see TTFDump) into the CSV format written by
+ * oldspot --dump-ttfs: a row for each component with its name followed by its times
+ * to failure in the order they happened.
+ */
+int
+main(int argc, char* argv[])
+{
+    using namespace TCLAP;
+
+    vector<string> time_units{"seconds", "minutes", "hours", "days", "weeks", "months", "years"};
+    ValuesConstraint<string> time_constraint(time_units);
+
+    CmdLine cmd("Convert a binary time-to-failure dump from oldspot to CSV", ' ', "0.1");
+    ValueArg<string> time("", "time-units", "Units for displaying time to failure (default: hours)", false, "hours", &time_constraint, cmd);
+    UnlabeledValueArg<string> input("dump", "Binary dump written by oldspot --dump-format binary", true, "", "filename", cmd);
+    UnlabeledValueArg<string> output("csv", "File to write the CSV table to (default: standard output)", false, "", "filename", cmd);
+
+    try
+    {
+        cmd.parse(argc, argv);
+    }
+    catch (ArgException& e)
+    {
+        cerr << "error: " << e.error() << " for arg " << e.argId() << endl;
+        return 1;
+    }
+
+    vector<string> names;
+    vector<vector<double>> ttfs;
+    bool complete = readTTFDump(input.getValue(), names, [&](uint32_t component, double t){
+        if (ttfs.size() < names.size())
+            ttfs.resize(names.size());
+        ttfs[component].push_back(t);
+    });
+    if (!complete)
+        return 1;
+    ttfs.resize(names.size());
+
+    ofstream file;
+    if (!output.getValue().empty())
+    {
+        file.open(output.getValue());
+        if (!file)
+        {
+            cerr << output.getValue() << ": unable to open file" << endl;
+            return 1;
+        }
+    }
+    ostream& csv = output.getValue().empty() ? cout : file;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        csv << names[i];
+        for (double t: ttfs[i])
+            csv << ',' << convert_time(t, time.getValue());
+        csv << '\n';
+    }
+    csv.flush();
+    return 0;
+}